@@ -0,0 +1,781 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "pig.h"
+
+/* Whether the timed code was built with optimizations */
+#ifdef __OPTIMIZE__
+#define BENCH_OPTIMIZED 1
+#else
+#define BENCH_OPTIMIZED 0
+#endif
+
+/* Size of the generated texture */
+#define TEX_SIZE 1024
+/* Triangles of the tiny scene and the side of each one in pixels */
+#define TINY_TRIS 200000
+#define TINY_SIZE 2.0f
+/* Full-screen layers of the overdraw scene */
+#define OVERDRAW_LAYERS 16
+/* Resolution of the scenes comparing the texture layouts */
+#define LAYOUT_WIDTH 1280
+#define LAYOUT_HEIGHT 720
+/* Rotation of the quad of the rotated scene, in degrees */
+#define ROTATED_ANGLE 60.0f
+/* Half width and depth of the ground plane and the world units covered by
+ * one repeat of the texture */
+#define GROUND_SIZE 50.0f
+#define GROUND_DEPTH 100.0f
+#define GROUND_REPEAT 4.0f
+
+/* Synthetic scenes */
+typedef enum
+{
+  /* Many triangles covering a pixel or two */
+  SCENE_TINY = 0,
+  /* Two full-screen quads, the far one drawn first */
+  SCENE_HUGE = 1,
+  /* Full-screen quads drawn back to front */
+  SCENE_OVERDRAW = 2,
+  /* Quad rotated in the screen, about one texel per pixel */
+  SCENE_ROTATED = 3,
+  /* Ground plane receding to the horizon, minified in the distance */
+  SCENE_PERSPECTIVE = 4,
+  SCENES = 5
+} scene_kind_t;
+
+/* Fill of the triangles */
+typedef enum
+{
+  /* Vertex colors */
+  BENCH_COLOR = 0,
+  /* Bilinear texturing of a texture stored row by row */
+  BENCH_LINEAR = 1,
+  /* Bilinear texturing of a texture stored in 4x4 blocks */
+  BENCH_TILED = 2,
+  BENCH_FILLS = 3
+} bench_fill_t;
+
+/* Triangles of a scene generated for a resolution */
+typedef struct
+{
+  vertex_t * verts;
+  puint32_t tris;
+  /* Transformation of the vertices */
+  mat mvp;
+  /* Pixels covered by the triangles, counting every layer, or zero if they
+   * are counted on the depth plane after the first run */
+  double fragments;
+} scene_t;
+
+/* Timings of a scene, fill and resolution */
+typedef struct
+{
+  scene_kind_t scene;
+  bench_fill_t fill;
+  puint32_t width, height;
+  /* Side of the bound texture, zero for vertex colors */
+  puint32_t tex_size;
+  puint32_t tris;
+  double fragments;
+  /* Median and fastest repetition in seconds */
+  double median, best;
+  /* Cache misses of a repetition on average, negative if not counted */
+  double misses;
+} result_t;
+
+/* Settings from the command line */
+typedef struct
+{
+  puint32_t warmup;
+  puint32_t reps;
+  puint32_t threads;
+  const char * json;
+  /* Cache miss counter, negative if the machine does not provide one */
+  int misses;
+} options_t;
+
+static const char * scene_names[SCENES] =
+{
+  "tiny", "huge", "overdraw", "rotated", "perspective"
+};
+static const char * fill_names[BENCH_FILLS] = { "color", "linear", "tiled" };
+static const puint32_t resolutions[][2] =
+{
+  { 640, 480 },
+  { 1280, 720 },
+  { 1920, 1080 }
+};
+static const puint32_t layout_sizes[] = { 2048, 4096, 8192 };
+
+/**
+ * Linear congruential generator, scenes are the same on every run
+ */
+static float
+bench_rand(puint32_t * seed)
+{
+  *seed = *seed * 1103515245u + 12345u;
+  return (float)((*seed >> 8) & 0xFFFF) / 65535.0f;
+}
+
+/**
+ * Seconds of a monotonic clock
+ */
+static double
+bench_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+compare_double(const void * a, const void * b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * Sets a vertex, positions are in normalized device coordinates
+ */
+static void
+set_vertex(vertex_t * v, float x, float y, float z, float u, float t,
+           puint32_t * seed)
+{
+  memset(v, 0, sizeof(vertex_t));
+  v->x = x;
+  v->y = y;
+  v->z = z;
+  v->r = bench_rand(seed);
+  v->g = bench_rand(seed);
+  v->b = bench_rand(seed);
+  v->a = 1.0f;
+  v->u = u;
+  v->v = t;
+  v->nz = 1.0f;
+}
+
+/**
+ * Adds a full-screen quad at depth z
+ */
+static void
+add_quad(vertex_t * v, float z, puint32_t * seed)
+{
+  set_vertex(&v[0], -1.0f, -1.0f, z, 0.0f, 0.0f, seed);
+  set_vertex(&v[1], 1.0f, -1.0f, z, 2.0f, 0.0f, seed);
+  set_vertex(&v[2], 1.0f, 1.0f, z, 2.0f, 2.0f, seed);
+  v[3] = v[0];
+  v[4] = v[2];
+  set_vertex(&v[5], -1.0f, 1.0f, z, 0.0f, 2.0f, seed);
+}
+
+/**
+ * Adds a square of side pixels rotated around the center of the screen,
+ * mapped to a window of the same number of texels
+ */
+static void
+add_rotated(vertex_t * v, puint32_t width, puint32_t height, float side,
+            puint32_t tex_size, puint32_t * seed)
+{
+  static const float corners[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+  static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+  float c, s, x, y;
+  int i, k;
+
+  c = (float)cos(ROTATED_ANGLE * PI / 180.0);
+  s = (float)sin(ROTATED_ANGLE * PI / 180.0);
+  for (i = 0; i < 6; ++i)
+  {
+    k = order[i];
+    x = (corners[k][0] - 0.5f) * side;
+    y = (corners[k][1] - 0.5f) * side;
+    set_vertex(&v[i], 2.0f * (c * x - s * y) / width,
+               2.0f * (s * x + c * y) / height, 0.5f,
+               corners[k][0] * side / tex_size,
+               corners[k][1] * side / tex_size, seed);
+  }
+}
+
+/**
+ * Adds a ground plane seen from above, the texture repeats over it
+ */
+static void
+add_ground(vertex_t * v, puint32_t width, puint32_t height, mat mvp,
+           puint32_t * seed)
+{
+  mat proj, view;
+  vec eye, at, up;
+  float u, t;
+
+  eye.x = 0.0f; eye.y = 1.0f; eye.z = 0.0f; eye.w = 1.0f;
+  at.x = 0.0f; at.y = 0.5f; at.z = -4.0f; at.w = 1.0f;
+  up.x = 0.0f; up.y = 1.0f; up.z = 0.0f; up.w = 0.0f;
+  mat_view(view, &eye, &at, &up);
+  mat_proj(proj, 60.0f, (float)width / height, 0.1f, 2.0f * GROUND_DEPTH);
+  mat_mul(mvp, proj, view);
+
+  /* Texture coordinates are kept positive */
+  u = 2.0f * GROUND_SIZE / GROUND_REPEAT;
+  t = GROUND_DEPTH / GROUND_REPEAT;
+  set_vertex(&v[0], -GROUND_SIZE, 0.0f, -0.5f, 0.0f, 0.0f, seed);
+  set_vertex(&v[1], GROUND_SIZE, 0.0f, -0.5f, u, 0.0f, seed);
+  set_vertex(&v[2], GROUND_SIZE, 0.0f, -GROUND_DEPTH, u, t, seed);
+  v[3] = v[0];
+  v[4] = v[2];
+  set_vertex(&v[5], -GROUND_SIZE, 0.0f, -GROUND_DEPTH, 0.0f, t, seed);
+}
+
+/**
+ * Opens a counter of the cache misses of this process and the threads it
+ * starts later on, returns -1 if there is none
+ */
+static int
+misses_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+/**
+ * Starts or stops counting cache misses
+ */
+static void
+misses_enable(int fd, int enable)
+{
+#ifdef __linux__
+  if (fd >= 0)
+  {
+    ioctl(fd, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+  }
+#else
+  (void)fd;
+  (void)enable;
+#endif
+}
+
+/**
+ * Cache misses counted so far, or -1 if the counter cannot be read
+ * A reset would not clear the counts of threads which have exited, so runs
+ * take the difference of two reads instead.
+ */
+static double
+misses_read(int fd)
+{
+#ifdef __linux__
+  puint64_t count;
+
+  if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+  {
+    return -1.0;
+  }
+  return (double)count;
+#else
+  (void)fd;
+  return -1.0;
+#endif
+}
+
+/**
+ * Generates a scene for a resolution and a texture of tex_size texels
+ */
+static int
+build_scene(scene_t * s, scene_kind_t kind, puint32_t width, puint32_t height,
+            puint32_t tex_size)
+{
+  puint32_t seed, i;
+  float x, y, z, dx, dy, u, t, side;
+
+  seed = 1;
+  s->tris = kind == SCENE_TINY ? TINY_TRIS :
+            (kind == SCENE_OVERDRAW ? 2 * OVERDRAW_LAYERS :
+            (kind == SCENE_HUGE ? 4 : 2));
+  if (!(s->verts = (vertex_t*)malloc(s->tris * 3 * sizeof(vertex_t))))
+  {
+    return 0;
+  }
+  mat_identity(s->mvp);
+
+  switch (kind)
+  {
+    case SCENE_TINY:
+    {
+      /* Right triangles with legs of TINY_SIZE pixels */
+      dx = 2.0f * TINY_SIZE / width;
+      dy = 2.0f * TINY_SIZE / height;
+      for (i = 0; i < s->tris; ++i)
+      {
+        x = bench_rand(&seed) * (2.0f - dx) - 1.0f;
+        y = bench_rand(&seed) * (2.0f - dy) - 1.0f;
+        z = bench_rand(&seed);
+        u = bench_rand(&seed);
+        t = bench_rand(&seed);
+        set_vertex(&s->verts[i * 3 + 0], x, y, z, u, t, &seed);
+        set_vertex(&s->verts[i * 3 + 1], x + dx, y, z,
+                   u + TINY_SIZE / TEX_SIZE, t, &seed);
+        set_vertex(&s->verts[i * 3 + 2], x, y + dy, z,
+                   u, t + TINY_SIZE / TEX_SIZE, &seed);
+      }
+      s->fragments = s->tris * TINY_SIZE * TINY_SIZE / 2.0;
+      break;
+    }
+    case SCENE_HUGE:
+    {
+      add_quad(s->verts, 0.75f, &seed);
+      add_quad(s->verts + 6, 0.25f, &seed);
+      s->fragments = 2.0 * width * height;
+      break;
+    }
+    case SCENE_ROTATED:
+    {
+      /* Largest square which stays on the screen once rotated */
+      side = (width < height ? width : height) * 0.95f /
+             (float)(fabs(cos(ROTATED_ANGLE * PI / 180.0)) +
+                     fabs(sin(ROTATED_ANGLE * PI / 180.0)));
+      add_rotated(s->verts, width, height, side, tex_size, &seed);
+      s->fragments = (double)side * side;
+      break;
+    }
+    case SCENE_PERSPECTIVE:
+    {
+      add_ground(s->verts, width, height, s->mvp, &seed);
+      s->fragments = 0.0;
+      break;
+    }
+    default:
+    {
+      for (i = 0; i < OVERDRAW_LAYERS; ++i)
+      {
+        add_quad(s->verts + i * 6, 1.0f - (i + 1.0f) / (OVERDRAW_LAYERS + 1),
+                 &seed);
+      }
+      s->fragments = (double)OVERDRAW_LAYERS * width * height;
+      break;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Generates a linear and a tiled texture with a different color in every
+ * texel, returns zero on failure
+ */
+static int
+build_textures(pig_texture_t ** tex, puint32_t size)
+{
+  puint8_t * data;
+  size_t i, n;
+  puint32_t seed;
+
+  n = (size_t)size * size * 4;
+  tex[BENCH_COLOR] = NULL;
+  tex[BENCH_LINEAR] = NULL;
+  tex[BENCH_TILED] = NULL;
+  if (!(data = (puint8_t*)malloc(n)))
+  {
+    return 0;
+  }
+  seed = 7;
+  for (i = 0; i < n; ++i)
+  {
+    data[i] = (puint8_t)(bench_rand(&seed) * 255.0f);
+  }
+
+  if ((tex[BENCH_LINEAR] = pig_texture_create(size, size, TEX_LINEAR)))
+  {
+    tex[BENCH_LINEAR]->filter = TEX_BILINEAR;
+    pig_texture_upload(tex[BENCH_LINEAR], data);
+  }
+  if ((tex[BENCH_TILED] = pig_texture_create(size, size, TEX_TILED)))
+  {
+    tex[BENCH_TILED]->filter = TEX_BILINEAR;
+    pig_texture_upload(tex[BENCH_TILED], data);
+  }
+  free(data);
+
+  return tex[BENCH_LINEAR] && tex[BENCH_TILED];
+}
+
+/**
+ * Releases the textures made by build_textures
+ */
+static void
+free_textures(pig_texture_t ** tex)
+{
+  pig_texture_free(tex[BENCH_LINEAR]);
+  pig_texture_free(tex[BENCH_TILED]);
+}
+
+/**
+ * Number of pixels written by the last draw, read from the depth plane
+ */
+static double
+count_covered(pig_t * p)
+{
+  double n;
+  float * depth;
+  puint32_t x, y;
+
+  n = 0.0;
+  for (y = 0; y < p->height; ++y)
+  {
+    depth = pig_depth_row(p, y);
+    for (x = 0; x < p->width; ++x)
+    {
+      n += depth[x] < 1.0f;
+    }
+  }
+  return n;
+}
+
+/**
+ * Times the draws of a scene, returns zero on failure
+ */
+static int
+run_scene(result_t * r, options_t * o, scene_t * s, pig_texture_t * tex)
+{
+  pig_t * p;
+  double * times, t, misses;
+  puint32_t i;
+
+  if (!(p = pig_init(r->width, r->height)) ||
+      !(times = (double*)malloc(o->reps * sizeof(double))))
+  {
+    pig_free(p);
+    return 0;
+  }
+
+  memcpy(p->m_mvp, s->mvp, sizeof(mat));
+  p->cull = CULL_NONE;
+  p->threads = o->threads;
+  p->mode = tex ? RM_TEXTURE : RM_COLOR;
+  pig_bind_texture(p, tex);
+
+  /* Warmup runs touch the planes and start the threads, cache misses are
+   * only counted over the timed runs */
+  misses = misses_read(o->misses);
+  for (i = 0; i < o->warmup + o->reps; ++i)
+  {
+    misses_enable(o->misses, i >= o->warmup);
+    t = bench_time();
+    pig_clear(p, CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST, 0, 1.0f);
+    pig_triangle(p, s->verts, s->tris);
+    pig_resolve(p);
+    t = bench_time() - t;
+    misses_enable(o->misses, 0);
+    if (i >= o->warmup)
+    {
+      times[i - o->warmup] = t;
+    }
+    if (!s->fragments)
+    {
+      s->fragments = count_covered(p);
+    }
+  }
+
+  qsort(times, o->reps, sizeof(double), compare_double);
+  r->median = times[o->reps / 2];
+  r->best = times[0];
+  r->tris = s->tris;
+  r->fragments = s->fragments;
+
+  /* Workers fold their counts into the counter as they exit */
+  free(times);
+  pig_free(p);
+  t = misses_read(o->misses);
+  r->misses = misses < 0.0 || t < 0.0 ? -1.0 : (t - misses) / o->reps;
+  return 1;
+}
+
+/**
+ * Formats the cache misses of a repetition per pixel, or what to print
+ * instead if they were not counted
+ */
+static const char *
+format_misses(char * buf, result_t * r, const char * none)
+{
+  if (r->misses < 0.0)
+  {
+    return none;
+  }
+  sprintf(buf, "%.4f", r->misses / r->fragments);
+  return buf;
+}
+
+/**
+ * Writes the results as JSON
+ */
+static int
+write_json(const char * path, options_t * o, result_t * results, puint32_t n)
+{
+  FILE * f;
+  result_t * r;
+  puint32_t i;
+  int first;
+  char buf[32], linear[32], tiled[32];
+
+  if (!(f = fopen(path, "w")))
+  {
+    return 0;
+  }
+
+  fprintf(f, "{\n  \"optimized\": %s,\n", BENCH_OPTIMIZED ? "true" : "false");
+  fprintf(f, "  \"warmup\": %u,\n  \"reps\": %u,\n  \"threads\": %u,\n",
+          (unsigned)o->warmup, (unsigned)o->reps, (unsigned)o->threads);
+  fprintf(f, "  \"results\": [\n");
+  for (i = 0, r = results; i < n; ++i, ++r)
+  {
+    fprintf(f, "    { \"scene\": \"%s\", \"fill\": \"%s\", "
+               "\"texture\": %u, "
+               "\"width\": %u, \"height\": %u, \"tris\": %u, "
+               "\"fragments\": %.0f, \"median_ms\": %.4f, "
+               "\"best_ms\": %.4f, \"mtris_per_s\": %.6f, "
+               "\"mpixels_per_s\": %.4f, \"ns_per_fragment\": %.4f, "
+               "\"misses_per_fragment\": %s }%s\n",
+            scene_names[r->scene], fill_names[r->fill], (unsigned)r->tex_size,
+            (unsigned)r->width, (unsigned)r->height, (unsigned)r->tris,
+            r->fragments, r->median * 1e3, r->best * 1e3,
+            r->tris / r->median * 1e-6,
+            (double)r->width * r->height / r->median * 1e-6,
+            r->median * 1e9 / r->fragments,
+            format_misses(buf, r, "null"), i + 1 < n ? "," : "");
+  }
+
+  /* Layout scenes run linear then tiled, each pair is summarized */
+  fprintf(f, "  ],\n  \"layouts\": [");
+  first = 1;
+  for (i = 1, r = results + 1; i < n; ++i, ++r)
+  {
+    if (r->scene >= SCENE_ROTATED && r->fill == BENCH_TILED)
+    {
+      fprintf(f, "%s\n    { \"scene\": \"%s\", \"texture\": %u, "
+                 "\"linear_ns_per_pixel\": %.4f, "
+                 "\"tiled_ns_per_pixel\": %.4f, "
+                 "\"tiled_speedup\": %.4f, "
+                 "\"linear_misses_per_pixel\": %s, "
+                 "\"tiled_misses_per_pixel\": %s }",
+              first ? "" : ",", scene_names[r->scene], (unsigned)r->tex_size,
+              r[-1].median * 1e9 / r[-1].fragments,
+              r->median * 1e9 / r->fragments, r[-1].median / r->median,
+              format_misses(linear, r - 1, "null"),
+              format_misses(tiled, r, "null"));
+      first = 0;
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+
+  return fclose(f) == 0;
+}
+
+static void
+usage(const char * name)
+{
+  fprintf(stderr, "usage: %s [-w warmup] [-r reps] [-t threads] "
+                  "[-o results.json]\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+  options_t o;
+  scene_t s;
+  result_t * results, * r;
+  pig_texture_t * tex[BENCH_FILLS];
+  puint32_t nres, nsizes, res, size, kind, fill, n;
+  int i, ok;
+  char misses[32];
+
+  o.warmup = 2;
+  o.reps = 9;
+  o.threads = 1;
+  o.json = "pig_bench.json";
+  for (i = 1; i < argc; ++i)
+  {
+    if (i + 1 < argc && !strcmp(argv[i], "-w"))
+    {
+      o.warmup = atoi(argv[++i]);
+    }
+    else if (i + 1 < argc && !strcmp(argv[i], "-r"))
+    {
+      o.reps = atoi(argv[++i]);
+    }
+    else if (i + 1 < argc && !strcmp(argv[i], "-t"))
+    {
+      o.threads = atoi(argv[++i]);
+    }
+    else if (i + 1 < argc && !strcmp(argv[i], "-o"))
+    {
+      o.json = argv[++i];
+    }
+    else
+    {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (o.reps < 1 || o.threads < 1)
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  /* Scenes up to SCENE_ROTATED run with every fill, the others compare the
+   * two texture layouts on larger textures */
+  nres = sizeof(resolutions) / sizeof(resolutions[0]);
+  nsizes = sizeof(layout_sizes) / sizeof(layout_sizes[0]);
+  n = nres * SCENE_ROTATED * BENCH_FILLS +
+      nsizes * (SCENES - SCENE_ROTATED) * (BENCH_FILLS - 1);
+  if ((o.misses = misses_open()) < 0)
+  {
+    fprintf(stderr, "No cache miss counter, only timings are reported\n");
+  }
+  if (!BENCH_OPTIMIZED)
+  {
+    fprintf(stderr, "Built without optimizations, "
+                    "configure with -DCMAKE_BUILD_TYPE=Release\n");
+  }
+  results = (result_t*)calloc(n, sizeof(result_t));
+  ok = build_textures(tex, TEX_SIZE) && results;
+
+  printf("%-9s %-7s %11s %9s %9s %9s %9s\n", "scene", "fill", "resolution",
+         "ms", "Mtris/s", "Mpix/s", "ns/frag");
+  r = results;
+  for (res = 0; res < nres && ok; ++res)
+  {
+    for (kind = 0; kind < SCENE_ROTATED && ok; ++kind)
+    {
+      if (!(ok = build_scene(&s, (scene_kind_t)kind, resolutions[res][0],
+                             resolutions[res][1], TEX_SIZE)))
+      {
+        break;
+      }
+      for (fill = 0; fill < BENCH_FILLS && ok; ++fill, ++r)
+      {
+        r->scene = (scene_kind_t)kind;
+        r->fill = (bench_fill_t)fill;
+        r->width = resolutions[res][0];
+        r->height = resolutions[res][1];
+        r->tex_size = tex[fill] ? TEX_SIZE : 0;
+        if (!(ok = run_scene(r, &o, &s, tex[fill])))
+        {
+          break;
+        }
+        printf("%-9s %-7s %5ux%-5u %9.3f %9.3f %9.1f %9.3f\n",
+               scene_names[kind], fill_names[fill],
+               (unsigned)r->width, (unsigned)r->height, r->median * 1e3,
+               r->tris / r->median * 1e-6,
+               (double)r->width * r->height / r->median * 1e-6,
+               r->median * 1e9 / r->fragments);
+      }
+      free(s.verts);
+    }
+  }
+  free_textures(tex);
+
+  printf("\n%-11s %7s %-7s %11s %9s %9s %9s %9s\n", "scene", "texture",
+         "layout", "resolution", "ms", "ns/pixel", "speedup", "miss/px");
+  for (size = 0; size < nsizes && ok; ++size)
+  {
+    if (!(ok = build_textures(tex, layout_sizes[size])))
+    {
+      free_textures(tex);
+      break;
+    }
+    for (kind = SCENE_ROTATED; kind < SCENES && ok; ++kind)
+    {
+      if (!(ok = build_scene(&s, (scene_kind_t)kind, LAYOUT_WIDTH,
+                             LAYOUT_HEIGHT, layout_sizes[size])))
+      {
+        break;
+      }
+      for (fill = BENCH_LINEAR; fill < BENCH_FILLS && ok; ++fill, ++r)
+      {
+        r->scene = (scene_kind_t)kind;
+        r->fill = (bench_fill_t)fill;
+        r->width = LAYOUT_WIDTH;
+        r->height = LAYOUT_HEIGHT;
+        r->tex_size = layout_sizes[size];
+        if (!(ok = run_scene(r, &o, &s, tex[fill])))
+        {
+          break;
+        }
+        /* Speedup of the layout over the linear one */
+        printf("%-11s %7u %-7s %5ux%-5u %9.3f %9.3f %9.3f %9s\n",
+               scene_names[kind], (unsigned)r->tex_size, fill_names[fill],
+               (unsigned)r->width, (unsigned)r->height, r->median * 1e3,
+               r->median * 1e9 / r->fragments,
+               fill == BENCH_LINEAR ? 1.0 : r[-1].median / r->median,
+               format_misses(misses, r, "n/a"));
+      }
+      free(s.verts);
+    }
+    free_textures(tex);
+  }
+
+  if (!ok)
+  {
+    fprintf(stderr, "Cannot run the benchmark\n");
+  }
+  else if (!write_json(o.json, &o, results, n))
+  {
+    fprintf(stderr, "Cannot write %s\n", o.json);
+    ok = 0;
+  }
+
+#ifdef __linux__
+  if (o.misses >= 0)
+  {
+    close(o.misses);
+  }
+#endif
+  free(results);
+  return ok ? 0 : -1;
+}
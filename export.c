@@ -0,0 +1,343 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "export.h"
+#include "rasterizer.h"
+
+/**
+ * Frame waiting in the queue of the exporter
+ */
+typedef struct
+{
+  /* Color plane and fast clears at the time of the submission */
+  pig_frame_t frame;
+  /* Destination, the path is copied */
+  pig_output_t out;
+  char * path;
+  /* Fence returned by pig_export_submit */
+  puint32_t fence;
+} job_t;
+
+struct exporter
+{
+  /* Encoder thread */
+  pthread_t thread;
+  /* Guards the queue */
+  pthread_mutex_t lock;
+  /* Signalled when a frame is queued or the exporter shuts down */
+  pthread_cond_t queued;
+  /* Signalled when a frame is written */
+  pthread_cond_t written;
+  /* Ring of queued frames, size entries long */
+  job_t * jobs;
+  puint32_t size, head, count;
+  /* Color planes not in use by the renderer or a queued frame */
+  puint32_t ** planes;
+  puint32_t free;
+  /* Fences of the last submitted and the last written frame */
+  puint32_t submitted, completed;
+  /* Set when the thread should exit once the queue is empty */
+  int quit;
+  /* Set once the thread runs, the lock and conditions exist until then */
+  int started;
+};
+
+void
+pig_frame_init(pig_frame_t * f, pig_t * p)
+{
+  f->color = p->color;
+  f->tiles = p->tiles;
+  f->clear_color = p->clear_color;
+  f->width = p->width;
+  f->height = p->height;
+  f->stride = p->stride;
+  f->tiles_x = p->tiles_x;
+}
+
+const puint32_t *
+pig_frame_row(void * arg, puint32_t y, puint32_t * scratch)
+{
+  pig_frame_t * f = (pig_frame_t*)arg;
+  puint32_t * row, i, j, tile, end;
+
+  /* Tiles with a pending clear are filled in without being resolved, so
+   * rows crossing them are assembled in scratch */
+  y = f->height - y - 1;
+  row = f->color + (size_t)y * f->stride;
+  tile = y / TILE_SIZE * f->tiles_x;
+  for (i = 0; i < f->tiles_x; ++i)
+  {
+    if (f->tiles[tile + i] & CLEAR_COLOR)
+    {
+      break;
+    }
+  }
+  if (i == f->tiles_x)
+  {
+    return row;
+  }
+
+  for (i = 0; i < f->width; i = end)
+  {
+    end = i + TILE_SIZE < f->width ? i + TILE_SIZE : f->width;
+    if (f->tiles[tile + i / TILE_SIZE] & CLEAR_COLOR)
+    {
+      for (j = i; j < end; ++j)
+      {
+        scratch[j] = f->clear_color;
+      }
+    }
+    else
+    {
+      memcpy(scratch + i, row + i, (end - i) * sizeof(puint32_t));
+    }
+  }
+  return scratch;
+}
+
+/**
+ * Encoder thread, writes the queued frames in submission order
+ * Strips are deflated on this thread alone, the rendering threads stay
+ * with the renderer.
+ */
+static void *
+export_worker(void * data)
+{
+  exporter_t * e = (exporter_t*)data;
+  job_t * job;
+  int ok;
+
+  pthread_mutex_lock(&e->lock);
+  while (1)
+  {
+    while (!e->quit && !e->count)
+    {
+      pthread_cond_wait(&e->queued, &e->lock);
+    }
+
+    if (!e->count)
+    {
+      break;
+    }
+
+    job = &e->jobs[e->head];
+    pthread_mutex_unlock(&e->lock);
+    ok = pig_output_write(&job->out, job->frame.width, job->frame.height,
+                          pig_frame_row, &job->frame, NULL);
+    free(job->path);
+
+    /* The fence is signalled after the callback returned */
+    if (job->out.done)
+    {
+      job->out.done(job->out.user, ok);
+    }
+    pthread_mutex_lock(&e->lock);
+
+    /* The plane of the frame can be rendered to again */
+    e->planes[e->free++] = job->frame.color;
+    e->completed = job->fence;
+    e->head = (e->head + 1) % e->size;
+    e->count--;
+    pthread_cond_broadcast(&e->written);
+  }
+  pthread_mutex_unlock(&e->lock);
+
+  return NULL;
+}
+
+exporter_t *
+pig_export_create(pig_t * p, puint32_t frames)
+{
+  exporter_t * e;
+  size_t size;
+  puint32_t i;
+
+  if (frames < 2 || !(e = (exporter_t*)calloc(1, sizeof(exporter_t))))
+  {
+    return NULL;
+  }
+
+  /* The renderer keeps one plane, the others go to the queued frames */
+  e->size = frames - 1;
+  size = (size_t)p->stride * p->height * sizeof(puint32_t);
+  if (!(e->jobs = (job_t*)calloc(e->size, sizeof(job_t))) ||
+      !(e->planes = (puint32_t**)calloc(e->size, sizeof(puint32_t*))))
+  {
+    pig_export_free(e, p);
+    return NULL;
+  }
+
+  /* Planes count as free as soon as they exist, so failures release them */
+  for (i = 0; i < e->size; ++i)
+  {
+    if (posix_memalign((void**)&e->planes[i], 64, size))
+    {
+      pig_export_free(e, p);
+      return NULL;
+    }
+    e->free++;
+    if (!(e->jobs[i].frame.tiles = (puint8_t*)malloc(p->tiles_x *
+                                                      p->tiles_y)))
+    {
+      pig_export_free(e, p);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&e->lock, NULL);
+  pthread_cond_init(&e->queued, NULL);
+  pthread_cond_init(&e->written, NULL);
+  if (pthread_create(&e->thread, NULL, export_worker, e))
+  {
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->queued);
+    pthread_cond_destroy(&e->written);
+    pig_export_free(e, p);
+    return NULL;
+  }
+  e->started = 1;
+
+  return e;
+}
+
+/**
+ * Queues the color plane of p and returns the fence of the frame
+ * Blocks while the queue is full. The renderer continues with a spare plane
+ * with a pending fast clear to the clear color, the depth plane is kept.
+ */
+puint32_t
+pig_export_submit(exporter_t * e, pig_t * p, pig_output_t * out)
+{
+  job_t * job;
+  puint8_t * tiles;
+  puint32_t fence;
+
+  /* Wait for a free slot, which bounds the frames in flight */
+  pthread_mutex_lock(&e->lock);
+  while (e->count == e->size)
+  {
+    pthread_cond_wait(&e->written, &e->lock);
+  }
+  pthread_mutex_unlock(&e->lock);
+
+  job = &e->jobs[(e->head + e->count) % e->size];
+  job->out = *out;
+  job->path = NULL;
+  if (out->path)
+  {
+    if (!(job->path = (char*)malloc(strlen(out->path) + 1)))
+    {
+      return 0;
+    }
+    strcpy(job->path, out->path);
+    job->out.path = job->path;
+  }
+
+  /* The color plane and its pending clears are handed over, the renderer
+   * goes on with a free plane */
+  pig_resolve(p);
+  tiles = job->frame.tiles;
+  pig_frame_init(&job->frame, p);
+  job->frame.tiles = tiles;
+  memcpy(tiles, p->tiles, p->tiles_x * p->tiles_y);
+
+  pthread_mutex_lock(&e->lock);
+  p->color = e->planes[--e->free];
+  job->fence = fence = ++e->submitted;
+  e->count++;
+  pthread_cond_signal(&e->queued);
+  pthread_mutex_unlock(&e->lock);
+
+  /* The new plane holds an old frame, the next one starts from a clear */
+  pig_clear(p, CLEAR_COLOR | CLEAR_FAST, p->clear_color, p->clear_depth);
+  return fence;
+}
+
+void
+pig_export_wait(exporter_t * e, puint32_t fence)
+{
+  pthread_mutex_lock(&e->lock);
+  while (e->completed < fence)
+  {
+    pthread_cond_wait(&e->written, &e->lock);
+  }
+  pthread_mutex_unlock(&e->lock);
+}
+
+int
+pig_export_done(exporter_t * e, puint32_t fence)
+{
+  int done;
+
+  pthread_mutex_lock(&e->lock);
+  done = e->completed >= fence;
+  pthread_mutex_unlock(&e->lock);
+
+  return done;
+}
+
+void
+pig_export_free(exporter_t * e, pig_t * p)
+{
+  puint32_t i;
+
+  if (!e)
+  {
+    return;
+  }
+
+  /* Queued frames are written before the thread exits */
+  if (e->started)
+  {
+    pthread_mutex_lock(&e->lock);
+    e->quit = 1;
+    pthread_cond_signal(&e->queued);
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->queued);
+    pthread_cond_destroy(&e->written);
+  }
+
+  /* Every plane but the renderer's is free once the queue is empty */
+  (void)p;
+  for (i = 0; i < e->free; ++i)
+  {
+    free(e->planes[i]);
+  }
+  if (e->jobs)
+  {
+    for (i = 0; i < e->size; ++i)
+    {
+      free(e->jobs[i].frame.tiles);
+    }
+  }
+  free(e->planes);
+  free(e->jobs);
+  free(e);
+}
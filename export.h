@@ -0,0 +1,51 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#ifndef __PIG_EXPORT_H__
+#define __PIG_EXPORT_H__
+
+#include "pig.h"
+
+/* Color plane handed to the encoders, along with its pending fast clears */
+typedef struct
+{
+  puint32_t * color;
+  puint8_t * tiles;
+  puint32_t clear_color;
+  /* Layout of the plane, as in pig_t */
+  puint32_t width, height, stride, tiles_x;
+} pig_frame_t;
+
+/* Background encoder of finished frames */
+typedef struct exporter exporter_t;
+
+void pig_frame_init(pig_frame_t *, pig_t *);
+const puint32_t * pig_frame_row(void *, puint32_t, puint32_t *);
+
+exporter_t * pig_export_create(pig_t *, puint32_t);
+puint32_t pig_export_submit(exporter_t *, pig_t *, pig_output_t *);
+void pig_export_wait(exporter_t *, puint32_t);
+int pig_export_done(exporter_t *, puint32_t);
+void pig_export_free(exporter_t *, pig_t *);
+
+#endif /*__PIG_EXPORT_H__*/
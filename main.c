@@ -27,47 +27,48 @@ THE SOFTWARE.
 int main()
 {
   pig_t * p;
+  pig_texture_t * tex;
   mat model, view, proj, vp;
   vec pos, at, up;
 
   vertex_t data[] =
   {
-    { 0.0,  1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0 },
-    { 0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0 },
-    { 1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0 },
-    { 1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0 },
-    { 0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0 },
-    { 1.0,  0.0,  1.0,  0.0,  0.0,  1.0,  1.0,  0.0 },
-    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0 },
-    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
-    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0 },
-    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0 },
-    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
-    { 1.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0 },
-    { 1.0,  0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0 },
-    { 1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  0.0 },
-    { 1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0 },
-    { 1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0 },
-    { 1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  0.0 },
-    { 1.0,  1.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0 },
-    { 0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
-    { 0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0 },
-    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0 },
-    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0 },
-    { 0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0 },
-    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0 },
-    { 0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
-    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0 },
-    { 1.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0 },
-    { 1.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0 },
-    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  0.0 },
-    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0 },
-    { 0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0 },
-    { 0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  0.0,  1.0 },
-    { 1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0 },
-    { 1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0 },
-    { 0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  0.0,  1.0 },
-    { 1.0,  1.0,  1.0,  0.0,  1.0,  0.0,  1.0,  1.0 }
+    { 0.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  0.0,  1.0 },
+    { 0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
+    { 1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0 },
+    { 1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0 },
+    { 0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0 },
+    { 1.0,  0.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0 },
+    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  0.0, -1.0 },
+    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0,  0.0, -1.0 },
+    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0,  0.0,  0.0,  0.0, -1.0 },
+    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0,  0.0,  0.0,  0.0, -1.0 },
+    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0,  0.0, -1.0 },
+    { 1.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0,  1.0,  0.0,  0.0, -1.0 },
+    { 1.0,  0.0,  1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  1.0,  0.0,  0.0 },
+    { 1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0 },
+    { 1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0,  1.0,  0.0,  0.0 },
+    { 1.0,  1.0,  1.0,  1.0,  0.0,  0.0,  1.0,  1.0,  1.0,  1.0,  0.0,  0.0 },
+    { 1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  0.0 },
+    { 1.0,  1.0,  0.0,  1.0,  0.0,  0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  0.0 },
+    { 0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  0.0,  1.0, -1.0,  0.0,  0.0 },
+    { 0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0,  1.0, -1.0,  0.0,  0.0 },
+    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  0.0, -1.0,  0.0,  0.0 },
+    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  0.0, -1.0,  0.0,  0.0 },
+    { 0.0,  1.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0,  1.0, -1.0,  0.0,  0.0 },
+    { 0.0,  1.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0,  0.0, -1.0,  0.0,  0.0 },
+    { 0.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0, -1.0,  0.0 },
+    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0, -1.0,  0.0 },
+    { 1.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0,  1.0,  0.0, -1.0,  0.0 },
+    { 1.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  1.0,  1.0,  0.0, -1.0,  0.0 },
+    { 0.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  0.0,  0.0,  0.0, -1.0,  0.0 },
+    { 1.0,  0.0,  0.0,  0.0,  0.0,  0.0,  1.0,  1.0,  0.0,  0.0, -1.0,  0.0 },
+    { 0.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  0.0,  0.0,  0.0,  1.0,  0.0 },
+    { 0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0 },
+    { 1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  1.0,  0.0,  0.0,  1.0,  0.0 },
+    { 1.0,  1.0,  0.0,  0.0,  1.0,  0.0,  1.0,  1.0,  0.0,  0.0,  1.0,  0.0 },
+    { 0.0,  1.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0,  1.0,  0.0 },
+    { 1.0,  1.0,  1.0,  0.0,  1.0,  0.0,  1.0,  1.0,  1.0,  0.0,  1.0,  0.0 }
   };
 
   puint8_t tex_data[] =
@@ -98,6 +99,14 @@ int main()
     return -1;
   }
 
+  if (!(tex = pig_texture_create(6, 18, TEX_TILED)))
+  {
+    fprintf(stderr, "Cannot create texture");
+    pig_free(p);
+    return -1;
+  }
+  pig_texture_upload(tex, tex_data);
+
   pos.x = 6.0f; pos.y = 6.0f; pos.z = 6.0f;
   at.x = 0.0f; at.y = 0.0f; at.z = 0.0f;
   up.x = 0.0f; up.y = 1.0f; up.z = 0.0f;
@@ -109,13 +118,12 @@ int main()
   mat_mul(vp, proj, view);
   mat_mul(p->m_mvp, vp, model);
   p->mode = RM_TEXTURE;
-  p->tex_data = tex_data;
-  p->tex_width = 6;
-  p->tex_height = 18;
+  pig_bind_texture(p, tex);
 
   pig_triangle(p, data, 12);
 
   pig_show(p);
   pig_free(p);
+  pig_texture_free(tex);
   return 0;
 }
@@ -0,0 +1,748 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <immintrin.h>
+#include "output.h"
+
+/* Bytes per pixel of RGB rows, alpha is dropped */
+#define RGB_BPP 3
+
+/* Room left in front of and after each deflated strip for the zlib header
+ * and the Adler-32 trailer, and slack for the final flush */
+#define ZLIB_HEADER 2
+#define ZLIB_TRAILER 4
+#define FLUSH_SLACK 64
+
+/* Largest IDAT chunk written, the deflated stream is split into chunks of
+ * this size */
+#define IDAT_SIZE (256 * 1024)
+
+/* Largest filtered strip deflated in one piece, keeping the bound of its
+ * deflated size within the 32-bit counters of zlib */
+#define STRIP_LIMIT (1u << 30)
+
+/* PNG file signature */
+static const puint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+/**
+ * Horizontal strip of an image, deflated on its own
+ */
+typedef struct
+{
+  /* Deflated rows, starting ZLIB_HEADER bytes into the buffer */
+  puint8_t * data;
+  size_t size;
+  /* Adler-32 and length of the filtered rows */
+  uLong adler;
+  size_t length;
+  /* Non-zero once deflated */
+  int ok;
+} strip_t;
+
+/**
+ * Image being encoded, shared by the strip tasks
+ */
+typedef struct
+{
+  pig_output_t * out;
+  puint32_t width, height;
+  /* Rows of each strip, the last strip may be shorter */
+  puint32_t rows;
+  pig_row_fn row;
+  void * arg;
+  strip_t * strips;
+  puint32_t nstrips;
+} encoder_t;
+
+/**
+ * Destination of the encoded bytes, the first failure sticks
+ */
+typedef struct
+{
+  pig_output_t * out;
+  FILE * file;
+  int ok;
+} writer_t;
+
+void
+pig_output_init(pig_output_t * out, const char * path)
+{
+  out->path = path;
+  out->file = NULL;
+  out->sink = NULL;
+  out->user = NULL;
+  out->level = Z_DEFAULT_COMPRESSION;
+  out->filter = FILTER_ADAPTIVE;
+  out->strips = 1;
+  out->format = OUTPUT_PNG;
+  out->done = NULL;
+}
+
+/**
+ * Drops the alpha channel of a row of RGBA8 pixels
+ */
+static void
+pack_row(puint8_t * d, const puint32_t * row, puint32_t width)
+{
+  const puint8_t * s = (const puint8_t*)row;
+  puint32_t i;
+
+  for (i = 0; i < width; ++i, d += RGB_BPP, s += 4)
+  {
+    d[0] = s[0];
+    d[1] = s[1];
+    d[2] = s[2];
+  }
+}
+
+/**
+ * Paeth predictor of the PNG format
+ */
+static int
+paeth(int a, int b, int c)
+{
+  int pa, pb, pc;
+
+  pa = abs(b - c);
+  pb = abs(a - c);
+  pc = abs(a + b - 2 * c);
+  return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+/**
+ * Paeth predictor of eight bytes widened to 16-bit lanes
+ */
+static __m128i
+paeth_epi16(__m128i a, __m128i b, __m128i c)
+{
+  __m128i pa, pb, pc, t;
+
+  t = _mm_sub_epi16(b, c);
+  pa = _mm_max_epi16(t, _mm_sub_epi16(_mm_setzero_si128(), t));
+  t = _mm_sub_epi16(a, c);
+  pb = _mm_max_epi16(t, _mm_sub_epi16(_mm_setzero_si128(), t));
+  t = _mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c));
+  pc = _mm_max_epi16(t, _mm_sub_epi16(_mm_setzero_si128(), t));
+
+  /* b where pb <= pc else c, then a where pa <= pb and pa <= pc */
+  t = _mm_cmpgt_epi16(pb, pc);
+  b = _mm_or_si128(_mm_andnot_si128(t, b), _mm_and_si128(t, c));
+  t = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  return _mm_or_si128(_mm_andnot_si128(t, a), _mm_and_si128(t, b));
+}
+
+/**
+ * Filters n bytes of a row, prev is the unfiltered row above it
+ * The filter type is written in front of the filtered bytes. Bytes only
+ * depend on the unfiltered rows, so they are filtered 16 or 8 at a time.
+ */
+static void
+filter_row(puint8_t * d, const puint8_t * cur, const puint8_t * prev,
+           size_t n, int type)
+{
+  __m128i a, b, c, zero;
+  size_t i;
+
+  zero = _mm_setzero_si128();
+  *d++ = type;
+  switch (type)
+  {
+    case FILTER_SUB:
+      memcpy(d, cur, RGB_BPP);
+      for (i = RGB_BPP; i + 16 <= n; i += 16)
+      {
+        _mm_storeu_si128((__m128i*)(d + i), _mm_sub_epi8(
+          _mm_loadu_si128((__m128i*)(cur + i)),
+          _mm_loadu_si128((__m128i*)(cur + i - RGB_BPP))));
+      }
+      for (; i < n; ++i)
+      {
+        d[i] = cur[i] - cur[i - RGB_BPP];
+      }
+      break;
+    case FILTER_UP:
+      for (i = 0; i + 16 <= n; i += 16)
+      {
+        _mm_storeu_si128((__m128i*)(d + i), _mm_sub_epi8(
+          _mm_loadu_si128((__m128i*)(cur + i)),
+          _mm_loadu_si128((__m128i*)(prev + i))));
+      }
+      for (; i < n; ++i)
+      {
+        d[i] = cur[i] - prev[i];
+      }
+      break;
+    case FILTER_AVERAGE:
+      for (i = 0; i < RGB_BPP; ++i)
+      {
+        d[i] = cur[i] - (prev[i] >> 1);
+      }
+      for (; i + 16 <= n; i += 16)
+      {
+        /* The rounded average is one too large if a + b is odd */
+        a = _mm_loadu_si128((__m128i*)(cur + i - RGB_BPP));
+        b = _mm_loadu_si128((__m128i*)(prev + i));
+        c = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(
+          _mm_xor_si128(a, b), _mm_set1_epi8(1)));
+        _mm_storeu_si128((__m128i*)(d + i), _mm_sub_epi8(
+          _mm_loadu_si128((__m128i*)(cur + i)), c));
+      }
+      for (; i < n; ++i)
+      {
+        d[i] = cur[i] - ((cur[i - RGB_BPP] + prev[i]) >> 1);
+      }
+      break;
+    case FILTER_PAETH:
+      for (i = 0; i < RGB_BPP; ++i)
+      {
+        d[i] = cur[i] - prev[i];
+      }
+      for (; i + 8 <= n; i += 8)
+      {
+        a = _mm_unpacklo_epi8(
+          _mm_loadl_epi64((__m128i*)(cur + i - RGB_BPP)), zero);
+        b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(prev + i)), zero);
+        c = _mm_unpacklo_epi8(
+          _mm_loadl_epi64((__m128i*)(prev + i - RGB_BPP)), zero);
+        c = paeth_epi16(a, b, c);
+        _mm_storel_epi64((__m128i*)(d + i), _mm_sub_epi8(
+          _mm_loadl_epi64((__m128i*)(cur + i)), _mm_packus_epi16(c, c)));
+      }
+      for (; i < n; ++i)
+      {
+        d[i] = cur[i] - paeth(cur[i - RGB_BPP], prev[i], prev[i - RGB_BPP]);
+      }
+      break;
+    default:
+      memcpy(d, cur, n);
+      break;
+  }
+}
+
+/**
+ * Sum of the absolute values of filtered bytes taken as signed, the usual
+ * estimate of how well a filtered row compresses
+ * The absolute value of a byte is the smaller of x and 256 - x, which are
+ * summed 16 at a time by psadbw.
+ */
+static size_t
+filter_cost(const puint8_t * d, size_t n)
+{
+  __m128i x, sum, zero;
+  size_t i, cost;
+
+  zero = _mm_setzero_si128();
+  sum = zero;
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    x = _mm_loadu_si128((__m128i*)(d + i));
+    x = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(x, zero));
+  }
+
+  cost = (size_t)_mm_cvtsi128_si32(sum) +
+         (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  for (; i < n; ++i)
+  {
+    cost += d[i] < 128 ? d[i] : 256 - d[i];
+  }
+  return cost;
+}
+
+/**
+ * Filters a row with the filter of out and returns the filtered row
+ * The adaptive filter tries all five filters into filt and keeps the one
+ * with the lowest cost.
+ */
+static puint8_t *
+select_filter(pig_output_t * out, puint8_t ** filt, const puint8_t * cur,
+              const puint8_t * prev, size_t n)
+{
+  puint8_t * best;
+  size_t cost, min_cost;
+  int type;
+
+  best = filt[0];
+  if (out->filter < FILTER_ADAPTIVE)
+  {
+    filter_row(best, cur, prev, n, out->filter);
+    return best;
+  }
+
+  min_cost = 0;
+  for (type = 0; type < FILTER_ADAPTIVE; ++type)
+  {
+    filter_row(filt[type], cur, prev, n, type);
+    cost = filter_cost(filt[type] + 1, n);
+    if (type == 0 || cost < min_cost)
+    {
+      best = filt[type];
+      min_cost = cost;
+    }
+  }
+  return best;
+}
+
+/**
+ * Filters and deflates the rows of a strip into a raw deflate stream
+ * Strips other than the last end in a sync flush, which leaves them
+ * byte-aligned and unterminated, so they can be concatenated.
+ */
+static void
+encode_strip(void * arg, puint32_t idx)
+{
+  encoder_t * e = (encoder_t*)arg;
+  strip_t * s = &e->strips[idx];
+  puint8_t * rows, * rgb[2], * filt[FILTER_ADAPTIVE], * best, * tmp;
+  puint32_t * scratch, y, y0, y1;
+  size_t n;
+  z_stream z;
+  int i, flush, last;
+
+  y0 = idx * e->rows;
+  y1 = y0 + e->rows < e->height ? y0 + e->rows : e->height;
+  last = idx + 1 == e->nstrips;
+  n = (size_t)e->width * RGB_BPP;
+  s->length = (y1 - y0) * (n + 1);
+  s->adler = adler32(0L, Z_NULL, 0);
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, e->out->level, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    return;
+  }
+
+  /* Rows are packed into rgb, then filtered by one or all of the filters */
+  scratch = (puint32_t*)malloc(e->width * sizeof(puint32_t));
+  rows = (puint8_t*)calloc(2, n);
+  filt[0] = (puint8_t*)malloc((n + 1) * FILTER_ADAPTIVE);
+  s->data = (puint8_t*)malloc(deflateBound(&z, s->length) + ZLIB_HEADER +
+                              ZLIB_TRAILER + FLUSH_SLACK);
+  if (!scratch || !rows || !filt[0] || !s->data)
+  {
+    goto cleanup;
+  }
+  rgb[0] = rows;
+  rgb[1] = rows + n;
+  for (i = 1; i < FILTER_ADAPTIVE; ++i)
+  {
+    filt[i] = filt[i - 1] + n + 1;
+  }
+
+  /* The first row is filtered against the last one of the previous strip */
+  if (y0 > 0)
+  {
+    pack_row(rgb[1], e->row(e->arg, y0 - 1, scratch), e->width);
+  }
+
+  z.next_out = s->data + ZLIB_HEADER;
+  z.avail_out = deflateBound(&z, s->length) + FLUSH_SLACK;
+  for (y = y0; y < y1; ++y)
+  {
+    pack_row(rgb[0], e->row(e->arg, y, scratch), e->width);
+    best = select_filter(e->out, filt, rgb[0], rgb[1], n);
+
+    s->adler = adler32(s->adler, best, n + 1);
+    z.next_in = best;
+    z.avail_in = n + 1;
+    flush = y + 1 < y1 ? Z_NO_FLUSH : (last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (deflate(&z, flush) == Z_STREAM_ERROR || z.avail_in || !z.avail_out)
+    {
+      goto cleanup;
+    }
+
+    tmp = rgb[0];
+    rgb[0] = rgb[1];
+    rgb[1] = tmp;
+  }
+
+  s->size = z.total_out;
+  s->ok = 1;
+
+cleanup:
+  deflateEnd(&z);
+  free(scratch);
+  free(rows);
+  free(filt[0]);
+}
+
+/**
+ * Opens the destination of out, nothing is opened unless ok is set
+ */
+static void
+open_writer(writer_t * w, pig_output_t * out, int ok)
+{
+  w->out = out;
+  w->file = NULL;
+  w->ok = ok;
+  if (w->ok)
+  {
+    w->file = out->path ? fopen(out->path, "wb") : out->file;
+    w->ok = w->file || out->sink;
+  }
+}
+
+/**
+ * Closes files opened by open_writer, which may fail to flush
+ */
+static void
+close_writer(writer_t * w)
+{
+  if (w->out->path && w->file && fclose(w->file))
+  {
+    w->ok = 0;
+  }
+}
+
+/**
+ * Hands bytes to the destination of the writer
+ */
+static void
+put(writer_t * w, const void * data, size_t size)
+{
+  if (!w->ok || !size)
+  {
+    return;
+  }
+
+  if (w->file)
+  {
+    w->ok = fwrite(data, 1, size, w->file) == size;
+  }
+  else
+  {
+    w->ok = w->out->sink(w->out->user, data, size) != 0;
+  }
+}
+
+/**
+ * Stores a 32-bit value in network byte order
+ */
+static void
+put_u32(puint8_t * d, puint32_t v)
+{
+  d[0] = (v >> 24) & 0xFF;
+  d[1] = (v >> 16) & 0xFF;
+  d[2] = (v >> 8) & 0xFF;
+  d[3] = v & 0xFF;
+}
+
+/**
+ * Writes a chunk, the CRC covers the type and the data
+ */
+static void
+put_chunk(writer_t * w, const char * type, const puint8_t * data, size_t size)
+{
+  puint8_t head[8], crc[4];
+  uLong c;
+
+  put_u32(head, size);
+  memcpy(head + 4, type, 4);
+  c = crc32(0L, head + 4, 4);
+  if (size)
+  {
+    c = crc32(c, data, size);
+  }
+  put_u32(crc, c);
+
+  put(w, head, 8);
+  put(w, data, size);
+  put(w, crc, 4);
+}
+
+/**
+ * zlib stream header, the level is only a hint for decoders
+ */
+static void
+zlib_header(puint8_t * d, int level)
+{
+  int flg;
+
+  flg = level < 0 || level == 6 ? 2 : (level < 2 ? 0 : (level < 6 ? 1 : 3));
+  d[0] = 0x78;
+  d[1] = flg << 6;
+  d[1] += 31 - (d[0] * 256 + d[1]) % 31;
+}
+
+/**
+ * Writes the signature and the header chunk of an RGB image
+ */
+static void
+put_header(writer_t * w, puint32_t width, puint32_t height)
+{
+  puint8_t ihdr[13];
+
+  put(w, signature, sizeof(signature));
+  put_u32(ihdr, width);
+  put_u32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = 2;
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+  put_chunk(w, "IHDR", ihdr, sizeof(ihdr));
+}
+
+/**
+ * Writes part of the zlib stream as IDAT chunks of at most IDAT_SIZE bytes
+ */
+static void
+put_idat(writer_t * w, const puint8_t * data, size_t size)
+{
+  size_t n;
+
+  for (; size; data += n, size -= n)
+  {
+    n = size < IDAT_SIZE ? size : IDAT_SIZE;
+    put_chunk(w, "IDAT", data, n);
+  }
+}
+
+/**
+ * Encodes an image with a single zlib stream, written out as it is deflated
+ * Rows are pulled in order and only IDAT_SIZE bytes of deflated data are
+ * held at a time, so memory does not grow with the image.
+ */
+static int
+stream_png(pig_output_t * out, puint32_t width, puint32_t height,
+           pig_row_fn row, void * arg)
+{
+  writer_t w;
+  z_stream z;
+  puint8_t * rows, * rgb[2], * filt[FILTER_ADAPTIVE], * chunk, * best, * tmp;
+  puint32_t * scratch, y;
+  size_t n;
+  int i, ret, flush, init;
+
+  memset(&z, 0, sizeof(z));
+  init = deflateInit(&z, out->level) == Z_OK;
+
+  n = (size_t)width * RGB_BPP;
+  scratch = (puint32_t*)malloc(width * sizeof(puint32_t));
+  rows = (puint8_t*)calloc(2, n);
+  filt[0] = (puint8_t*)malloc((n + 1) * FILTER_ADAPTIVE);
+  chunk = (puint8_t*)malloc(IDAT_SIZE);
+  open_writer(&w, out, init && scratch && rows && filt[0] && chunk);
+  if (!w.ok)
+  {
+    goto cleanup;
+  }
+  rgb[0] = rows;
+  rgb[1] = rows + n;
+  for (i = 1; i < FILTER_ADAPTIVE; ++i)
+  {
+    filt[i] = filt[i - 1] + n + 1;
+  }
+
+  put_header(&w, width, height);
+  z.next_out = chunk;
+  z.avail_out = IDAT_SIZE;
+  for (y = 0; y < height && w.ok; ++y)
+  {
+    pack_row(rgb[0], row(arg, y, scratch), width);
+    best = select_filter(out, filt, rgb[0], rgb[1], n);
+
+    /* Full chunks are written as soon as deflate fills them */
+    z.next_in = best;
+    z.avail_in = n + 1;
+    flush = y + 1 < height ? Z_NO_FLUSH : Z_FINISH;
+    do
+    {
+      ret = deflate(&z, flush);
+      if (ret == Z_STREAM_ERROR)
+      {
+        w.ok = 0;
+        break;
+      }
+      if (!z.avail_out || ret == Z_STREAM_END)
+      {
+        put_idat(&w, chunk, IDAT_SIZE - z.avail_out);
+        z.next_out = chunk;
+        z.avail_out = IDAT_SIZE;
+      }
+    }
+    while (w.ok && (z.avail_in || (flush == Z_FINISH && ret != Z_STREAM_END)));
+
+    tmp = rgb[0];
+    rgb[0] = rgb[1];
+    rgb[1] = tmp;
+  }
+  put_chunk(&w, "IEND", NULL, 0);
+
+cleanup:
+  close_writer(&w);
+  if (init)
+  {
+    deflateEnd(&z);
+  }
+  free(scratch);
+  free(rows);
+  free(filt[0]);
+  free(chunk);
+
+  return w.ok;
+}
+
+int
+pig_output_png(pig_output_t * out, puint32_t width, puint32_t height,
+               pig_row_fn row, void * arg, pool_t * pool)
+{
+  encoder_t e;
+  writer_t w;
+  strip_t * s;
+  uLong adler;
+  puint32_t i, limit;
+
+  if (!width || !height)
+  {
+    return 0;
+  }
+
+  /* Without threads to spread strips over, the image is streamed */
+  if (!pool || out->strips <= 1)
+  {
+    return stream_png(out, width, height, row, arg);
+  }
+
+  /* Strips are deflated independently, on the pool if there is one */
+  e.out = out;
+  e.width = width;
+  e.height = height;
+  e.row = row;
+  e.arg = arg;
+  limit = STRIP_LIMIT / (width * RGB_BPP + 1);
+  e.nstrips = out->strips > height ? height : out->strips;
+  e.rows = (height + e.nstrips - 1) / e.nstrips;
+  e.rows = e.rows < limit ? e.rows : (limit ? limit : 1);
+  e.nstrips = (height + e.rows - 1) / e.rows;
+  if (!(e.strips = (strip_t*)calloc(e.nstrips, sizeof(strip_t))))
+  {
+    return 0;
+  }
+  pool_run(pool, encode_strip, &e, e.nstrips);
+
+  /* Nothing is written if a strip failed */
+  w.ok = 1;
+  for (i = 0; i < e.nstrips; ++i)
+  {
+    w.ok = w.ok && e.strips[i].ok;
+  }
+  open_writer(&w, out, w.ok);
+
+  put_header(&w, width, height);
+
+  /* Strips are stitched into one zlib stream, with the header in front of
+   * the first one and the combined checksum after the last one */
+  adler = adler32(0L, Z_NULL, 0);
+  for (i = 0; i < e.nstrips && w.ok; ++i)
+  {
+    s = &e.strips[i];
+    adler = adler32_combine(adler, s->adler, s->length);
+    if (i == 0)
+    {
+      zlib_header(s->data, out->level);
+    }
+    if (i + 1 == e.nstrips)
+    {
+      put_u32(s->data + ZLIB_HEADER + s->size, adler);
+      s->size += ZLIB_TRAILER;
+    }
+    put_idat(&w, s->data + (i ? ZLIB_HEADER : 0),
+             s->size + (i ? 0 : ZLIB_HEADER));
+  }
+  put_chunk(&w, "IEND", NULL, 0);
+
+  close_writer(&w);
+  for (i = 0; i < e.nstrips; ++i)
+  {
+    free(e.strips[i].data);
+  }
+  free(e.strips);
+
+  return w.ok;
+}
+
+int
+pig_output_raw(pig_output_t * out, puint32_t width, puint32_t height,
+               pig_row_fn row, void * arg)
+{
+  writer_t w;
+  puint32_t * scratch, y;
+  puint8_t * packed;
+  const puint32_t * r;
+  char head[32];
+
+  if (!width || !height)
+  {
+    return 0;
+  }
+
+  /* RGBA rows go out as the row callback returns them, without a copy */
+  scratch = (puint32_t*)malloc(width * sizeof(puint32_t));
+  packed = NULL;
+  if (out->format != OUTPUT_RGBA)
+  {
+    packed = (puint8_t*)malloc(width * RGB_BPP);
+  }
+  open_writer(&w, out, scratch && (packed || out->format == OUTPUT_RGBA));
+
+  if (out->format == OUTPUT_PPM)
+  {
+    sprintf(head, "P6\n%u %u\n255\n", (unsigned)width, (unsigned)height);
+    put(&w, head, strlen(head));
+  }
+  for (y = 0; y < height && w.ok; ++y)
+  {
+    r = row(arg, y, scratch);
+    if (packed)
+    {
+      pack_row(packed, r, width);
+      put(&w, packed, width * RGB_BPP);
+    }
+    else
+    {
+      put(&w, r, width * sizeof(puint32_t));
+    }
+  }
+
+  close_writer(&w);
+  free(packed);
+  free(scratch);
+
+  return w.ok;
+}
+
+int
+pig_output_write(pig_output_t * out, puint32_t width, puint32_t height,
+                 pig_row_fn row, void * arg, pool_t * pool)
+{
+  if (out->format == OUTPUT_PNG)
+  {
+    return pig_output_png(out, width, height, row, arg, pool);
+  }
+  return pig_output_raw(out, width, height, row, arg);
+}
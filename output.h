@@ -0,0 +1,101 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#ifndef __PIG_OUTPUT_H__
+#define __PIG_OUTPUT_H__
+
+#include <stdio.h>
+#include "types.h"
+#include "pool.h"
+
+/* PNG row filters, the first five are the filter types of the format */
+typedef enum
+{
+  /* Rows are stored as they are, fastest to encode */
+  FILTER_NONE = 0,
+  /* Difference to the pixel on the left */
+  FILTER_SUB = 1,
+  /* Difference to the pixel above */
+  FILTER_UP = 2,
+  /* Difference to the mean of the pixels on the left and above */
+  FILTER_AVERAGE = 3,
+  /* Difference to the Paeth predictor of the left, upper and upper left
+   * pixels */
+  FILTER_PAETH = 4,
+  /* Filter of each row picked by the smallest sum of absolute differences */
+  FILTER_ADAPTIVE = 5
+} rowfilter_t;
+
+/* Image formats written by pig_output_write */
+typedef enum
+{
+  /* Deflated RGB, see pig_output_png */
+  OUTPUT_PNG = 0,
+  /* Binary PPM, a text header followed by the RGB rows */
+  OUTPUT_PPM = 1,
+  /* RGB rows, top to bottom, without a header */
+  OUTPUT_RGB = 2,
+  /* RGBA rows, top to bottom, written straight from the framebuffer */
+  OUTPUT_RGBA = 3
+} outformat_t;
+
+/* Receives encoded bytes, returns zero on failure */
+typedef int (*pig_sink_fn)(void *, const void *, size_t);
+
+/* Returns row y of an image counted from the top, as width RGBA8 pixels
+ * Rows which have to be assembled are written to the scratch row given. */
+typedef const puint32_t * (*pig_row_fn)(void *, puint32_t, puint32_t *);
+
+/* Destination and settings of encoded images */
+typedef struct
+{
+  /* File created at path if set */
+  const char * path;
+  /* Otherwise an open stream, left open */
+  FILE * file;
+  /* Otherwise a sink, called with user and the encoded bytes */
+  pig_sink_fn sink;
+  void * user;
+  /* zlib compression level, 0 stores the rows and 9 compresses best */
+  int level;
+  /* Row filter, rowfilter_t */
+  puint32_t filter;
+  /* Number of horizontal strips deflated independently, spread over the
+   * rendering threads and stitched into a single zlib stream. A single
+   * strip, or no threads, streams the image out as it is deflated. */
+  puint32_t strips;
+  /* Image format, outformat_t */
+  puint32_t format;
+  /* Called with user and the result once a frame queued by pig_submit is
+   * written, on the encoder thread and before its fence is signalled */
+  void (*done)(void *, int);
+} pig_output_t;
+
+void pig_output_init(pig_output_t *, const char *);
+int pig_output_png(pig_output_t *, puint32_t, puint32_t, pig_row_fn, void *,
+                   pool_t *);
+int pig_output_raw(pig_output_t *, puint32_t, puint32_t, pig_row_fn, void *);
+int pig_output_write(pig_output_t *, puint32_t, puint32_t, pig_row_fn, void *,
+                     pool_t *);
+
+#endif /*__PIG_OUTPUT_H__*/
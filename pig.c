@@ -21,118 +21,576 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 *******************************************************************************/
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <png.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "pig.h"
+#include "pool.h"
+#include "export.h"
 #include "rasterizer.h"
 
+/* Number of hierarchical Z blocks along the side of a tile */
+#define HIZ_BLOCKS (TILE_SIZE / BLOCK_SIZE)
+
 pig_t *
 pig_init(puint16_t width, puint16_t height)
 {
   pig_t * p;
-  pixel_t * px;
-  size_t buffer_size;
+  size_t size, tiles;
 
   if (!(p = (pig_t*)malloc(sizeof(pig_t))))
   {
     return NULL;
   }
 
+  /* Pick the kernels for the host CPU */
+  pig_raster_init();
+
   /* Initialise settings */
   p->width = width;
   p->height = height;
   p->mode = RM_COLOR;
-  p->tex_data = NULL;
-  p->tex_width = 0;
-  p->tex_height = 0;
+  p->texture = NULL;
+  p->light.dir.x = 0.0f;
+  p->light.dir.y = 0.0f;
+  p->light.dir.z = 1.0f;
+  p->light.dir.w = 0.0f;
+  p->light.ambient = 0.2f;
+  p->light.diffuse = 0.8f;
+  p->blend.src = BLEND_ONE;
+  p->blend.dst = BLEND_ZERO;
+  p->blend.premultiply = 0;
+  p->blend.sorted = 0;
+  p->line_depth = 1;
+  p->band_scale = 1.0f;
+  p->band_offset = 0.0f;
+  p->threads = 1;
+  p->pool = NULL;
+  p->xverts = NULL;
+  p->xverts_size = 0;
+  p->frags = NULL;
+  p->failed = 0;
+  p->exporter = NULL;
+  p->color_own = NULL;
+  p->color_map = 0;
 
-  /* Initialise the framebuffer */
-  buffer_size = p->width * p->height * sizeof(pixel_t);
-  p->fbuffer = (pixel_t*)malloc(buffer_size);
-  for (px = p->fbuffer; px - p->fbuffer < p->width * p->height; ++px) {
-    px->r = px->g = px->b = px->a = 0;
-    px->depth = 1.0f;
+  /* Initialise the framebuffer, rows are padded to 16 pixels */
+  p->stride = (p->width + 15) & ~15;
+  p->tiles_x = (p->width + TILE_SIZE - 1) / TILE_SIZE;
+  p->tiles_y = (p->height + TILE_SIZE - 1) / TILE_SIZE;
+  p->color = NULL;
+  p->depth = NULL;
+  p->samples = 1;
+  p->sample_color = NULL;
+  p->sample_depth = NULL;
+  p->sample_full = NULL;
+  p->tiles = NULL;
+  p->hiz_block = NULL;
+  p->hiz_tile = NULL;
+  p->culled_tris = 0;
+  p->culled_tiles = 0;
+  p->culled_faces = 0;
+  p->cull = CULL_BACK;
+  p->front = FRONT_CCW;
+  tiles = p->tiles_x * p->tiles_y;
+  size = (size_t)p->stride * p->height;
+  if (posix_memalign((void**)&p->color, 64, size * sizeof(puint32_t)) ||
+      posix_memalign((void**)&p->depth, 64, size * sizeof(float)) ||
+      !(p->tiles = (puint8_t*)calloc(tiles, 1)) ||
+      !(p->hiz_tile = (float*)malloc(tiles * sizeof(float))) ||
+      !(p->hiz_block = (float*)malloc(tiles * sizeof(float) *
+                                      HIZ_BLOCKS * HIZ_BLOCKS)))
+  {
+    pig_free(p);
+    return NULL;
   }
 
+  /* Pages of the framebuffer are only touched once drawn to */
+  pig_clear(p, CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST, 0, 1.0f);
+
   return p;
 }
 
+/**
+ * Returns to the own color plane, unmapping the bound one if it was mapped
+ */
+static void
+unbind_color(pig_t * p)
+{
+  if (p->color_map)
+  {
+    munmap(p->color, p->color_map);
+    p->color_map = 0;
+  }
+  if (p->color_own)
+  {
+    p->color = p->color_own;
+    p->color_own = NULL;
+  }
+}
+
 void
 pig_free(pig_t * p)
 {
+  puint32_t i;
+
   if (!p) {
     return;
   }
 
-  if (p->fbuffer) {
-    free(p->fbuffer);
-    p->fbuffer = NULL;
+  /* Queued frames are written out first */
+  pig_export_free(p->exporter, p);
+  unbind_color(p);
+
+  if (p->frags)
+  {
+    for (i = 0; i < p->tiles_x * p->tiles_y; ++i)
+    {
+      free(((pig_fraglist_t*)p->frags)[i].frags);
+    }
+    free(p->frags);
   }
+
+  free(p->color);
+  free(p->depth);
+  free(p->sample_color);
+  free(p->sample_depth);
+  free(p->sample_full);
+  free(p->tiles);
+  free(p->hiz_block);
+  free(p->hiz_tile);
+  pool_free(p->pool);
+  free(p->xverts);
+  free(p);
 }
 
 void
+pig_clear(pig_t * p, puint32_t flags, puint32_t color, float depth)
+{
+  puint32_t i, tiles;
+  pig_fraglist_t * lists;
+
+  tiles = p->tiles_x * p->tiles_y;
+  flags &= CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST;
+
+  if (flags & CLEAR_COLOR)
+  {
+    p->clear_color = color;
+
+    /* Fragments waiting to be composited are dropped along with the color */
+    if ((lists = (pig_fraglist_t*)p->frags))
+    {
+      for (i = 0; i < tiles; ++i)
+      {
+        lists[i].count = 0;
+      }
+    }
+  }
+  if (flags & CLEAR_DEPTH)
+  {
+    p->clear_depth = depth;
+
+    /* Every block of the hierarchical Z buffer ends up at the clear depth */
+    for (i = 0; i < tiles; ++i)
+    {
+      p->hiz_tile[i] = depth;
+    }
+    for (i = 0; i < tiles * HIZ_BLOCKS * HIZ_BLOCKS; ++i)
+    {
+      p->hiz_block[i] = depth;
+    }
+  }
+
+  /* Mark the tiles, they are cleared by the rasterizer or when read back */
+  if (flags & CLEAR_FAST)
+  {
+    for (i = 0; i < tiles; ++i)
+    {
+      p->tiles[i] |= flags & ~CLEAR_FAST;
+    }
+    return;
+  }
+
+  /* Clear everything now, dropping the overwritten pending clears */
+  pig_raster_clear(p, flags, color, depth,
+                   0, 0, p->stride - 1, p->height - 1);
+  for (i = 0; i < tiles; ++i)
+  {
+    p->tiles[i] &= ~flags;
+  }
+}
+
+int
 pig_triangle(pig_t * p, vertex_t * v, puint32_t count)
+{
+  return pig_raster_triangles(p, v, count);
+}
+
+int
+pig_draw_indexed(pig_t * p, vertex_t * v, puint32_t nverts,
+                 puint32_t * idx, puint32_t nidx)
+{
+  return pig_raster_indexed(p, v, nverts, idx, nidx / 3);
+}
+
+int
+pig_lines(pig_t * p, vertex_t * v, puint32_t count)
+{
+  return pig_raster_lines(p, v, count);
+}
+
+int
+pig_wireframe(pig_t * p, vertex_t * v, puint32_t nverts,
+              puint32_t * idx, puint32_t nidx)
+{
+  return pig_raster_wireframe(p, v, nverts, idx, nidx / 3);
+}
+
+void
+pig_bind_texture(pig_t * p, pig_texture_t * tex)
+{
+  p->texture = tex;
+}
+
+int
+pig_composite(pig_t * p)
+{
+  return pig_raster_composite(p);
+}
+
+int
+pig_set_samples(pig_t * p, puint32_t samples)
+{
+  size_t size;
+
+  if (samples != 1 && samples != 4)
+  {
+    return 0;
+  }
+
+  /* Sample planes are kept once allocated */
+  size = (size_t)p->stride * p->height;
+  if (samples == 4 && !p->sample_color)
+  {
+    if (posix_memalign((void**)&p->sample_color, 64,
+                       size * 4 * sizeof(puint32_t)) ||
+        posix_memalign((void**)&p->sample_depth, 64,
+                       size * 4 * sizeof(float)) ||
+        !(p->sample_full = (puint8_t*)malloc(size)))
+    {
+      free(p->sample_color);
+      free(p->sample_depth);
+      p->sample_color = NULL;
+      p->sample_depth = NULL;
+      return 0;
+    }
+  }
+
+  /* Samples are not converted, drawing starts over from the clear values */
+  p->samples = samples;
+  pig_clear(p, CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST,
+            p->clear_color, p->clear_depth);
+  return 1;
+}
+
+void
+pig_resolve(pig_t * p)
+{
+  if (p->samples > 1)
+  {
+    pig_raster_downsample(p);
+  }
+}
+
+int
+pig_write(pig_t * p, pig_output_t * out)
+{
+  pig_frame_t frame;
+
+  pig_resolve(p);
+  pig_frame_init(&frame, p);
+  return pig_output_write(out, p->width, p->height, pig_frame_row, &frame,
+                          out->strips > 1 ? pig_raster_pool(p) : NULL);
+}
+
+void
+pig_flush(pig_t * p)
 {
   puint32_t i;
-  for (i = 0; i < count; ++i) {
-    pig_raster_triangle(p, &v[i * 3 + 0], &v[i * 3 + 1], &v[i * 3 + 2]);
+
+  /* Pending clears are carried out so the plane can be read as it is */
+  pig_resolve(p);
+  for (i = 0; i < p->tiles_x * p->tiles_y; ++i)
+  {
+    if (p->tiles[i] & CLEAR_COLOR)
+    {
+      pig_raster_resolve(p, i);
+    }
+  }
+}
+
+size_t
+pig_color_size(pig_t * p)
+{
+  return (size_t)p->stride * p->height * sizeof(puint32_t);
+}
+
+int
+pig_bind_color(pig_t * p, puint32_t * color)
+{
+  if (p->exporter || ((size_t)color & 63))
+  {
+    return 0;
+  }
+
+  /* Neither plane holds the image drawn so far, it starts over cleared */
+  unbind_color(p);
+  if (color)
+  {
+    p->color_own = p->color;
+    p->color = color;
+  }
+  pig_clear(p, CLEAR_COLOR | CLEAR_FAST, p->clear_color, p->clear_depth);
+  return 1;
+}
+
+int
+pig_map_color(pig_t * p, const char * name, int shm)
+{
+  void * color;
+  size_t size;
+  int fd;
+
+  /* The file or shared memory object is sized to hold the plane */
+  size = pig_color_size(p);
+  fd = shm ? shm_open(name, O_RDWR | O_CREAT, 0600) :
+             open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  color = MAP_FAILED;
+  if (!ftruncate(fd, size))
+  {
+    color = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (color == MAP_FAILED)
+  {
+    return 0;
+  }
+  if (!pig_bind_color(p, (puint32_t*)color))
+  {
+    munmap(color, size);
+    return 0;
+  }
+  p->color_map = size;
+  return 1;
+}
+
+int
+pig_set_frames(pig_t * p, puint32_t frames)
+{
+  exporter_t * e;
+
+  if (frames < 1 || frames > 3)
+  {
+    return 0;
+  }
+
+  /* Queued frames swap color planes, which a bound buffer cannot do */
+  if (frames > 1 && p->color_own)
+  {
+    return 0;
+  }
+
+  /* Frames in flight are written before the queue is replaced */
+  e = NULL;
+  if (frames > 1 && !(e = pig_export_create(p, frames)))
+  {
+    return 0;
+  }
+  pig_export_free(p->exporter, p);
+  p->exporter = e;
+  return 1;
+}
+
+puint32_t
+pig_submit(pig_t * p, pig_output_t * out)
+{
+  if (!p->exporter)
+  {
+    return 0;
   }
+  return pig_export_submit(p->exporter, p, out);
+}
+
+void
+pig_wait(pig_t * p, puint32_t fence)
+{
+  if (p->exporter)
+  {
+    pig_export_wait(p->exporter, fence);
+  }
+}
+
+int
+pig_done(pig_t * p, puint32_t fence)
+{
+  return !p->exporter || pig_export_done(p->exporter, fence);
 }
 
 void
 pig_show(pig_t * p)
 {
-  FILE * fout;
-  png_structp png_ptr;
-  png_infop info_ptr;
-  png_bytep row;
-  puint16_t i, j;
-  pixel_t * pix;
+  pig_output_t out;
 
-  if (!(fout = fopen("pig.png", "wb")))
+  /* With a frame queue the image is written in the background */
+  pig_output_init(&out, "pig.png");
+  if (!p->exporter || !pig_submit(p, &out))
   {
-    return;
+    pig_write(p, &out);
   }
+}
+
+/**
+ * Image rendered one band of rows at a time
+ */
+typedef struct
+{
+  pig_t * p;
+  pig_draw_fn draw;
+  void * user;
+  /* Height of the image and of a band */
+  puint32_t height, band;
+  /* Topmost row of the rendered band, counted from the top */
+  puint32_t top;
+  /* Set once a band was rendered */
+  int ready;
+  pig_frame_t frame;
+} banded_t;
 
-  if (!(png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                                          NULL, NULL, NULL)))
+/**
+ * Row y of a banded image, counted from the top
+ * Rows are requested in order, so each band is drawn once when the first of
+ * its rows is reached.
+ */
+static const puint32_t *
+banded_row(void * arg, puint32_t y, puint32_t * scratch)
+{
+  banded_t * b = (banded_t*)arg;
+  pig_t * p = b->p;
+  float bottom;
+
+  if (!b->ready || y < b->top || y >= b->top + b->band)
   {
-    fclose(fout);
-    return;
+    /* The band maps to the viewport, rows past the bottom of the image
+     * are drawn but never read */
+    b->top = y / b->band * b->band;
+    bottom = (float)b->height - b->top - b->band;
+    p->band_scale = (float)b->height / b->band;
+    p->band_offset = ((float)b->height - 2.0f * bottom - b->band) / b->band;
+    pig_clear(p, CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST,
+              p->clear_color, p->clear_depth);
+    b->draw(p, b->user);
+    pig_composite(p);
+    pig_resolve(p);
+    pig_frame_init(&b->frame, p);
+    b->ready = 1;
   }
 
-  if (!(info_ptr = png_create_info_struct(png_ptr)))
+  return pig_frame_row(&b->frame, y - b->top, scratch);
+}
+
+int
+pig_render_banded(pig_output_t * out, puint32_t width, puint32_t height,
+                  puint32_t band, pig_draw_fn draw, void * user)
+{
+  banded_t b;
+  int ok;
+
+  /* Bands are whole rows of tiles, the viewport is limited to 16 bits */
+  band = (band + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+  band = band < height ? band : height;
+  if (!width || !band || width > 0xFFFF || band > 0xFFFF)
   {
-    png_destroy_write_struct(&png_ptr, NULL);
-    fclose(fout);
-    return;
+    return 0;
+  }
+
+  b.draw = draw;
+  b.user = user;
+  b.height = height;
+  b.band = band;
+  b.top = 0;
+  b.ready = 0;
+  if (!(b.p = pig_init(width, band)))
+  {
+    return 0;
   }
 
-  png_init_io(png_ptr, fout);
-  png_set_IHDR(png_ptr, info_ptr, p->width, p->height,
-               8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-               PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-  png_write_info(png_ptr, info_ptr);
+  /* Rows must be pulled in order, so strips are not spread over threads */
+  ok = pig_output_write(out, width, height, banded_row, &b, NULL);
+  pig_free(b.p);
 
-  row = (png_bytep)malloc(sizeof(png_byte) * p->width * 3);
-  for (i = 0; i < p->height; ++i)
+  return ok;
+}
+
+/**
+ * Carries out the pending fast clears of the tiles overlapping row y
+ */
+static void
+resolve_row(pig_t * p, puint16_t y)
+{
+  puint32_t i, tile;
+
+  for (i = 0; i < p->tiles_x; ++i)
   {
-    for (j = 0; j < p->width; ++j)
+    tile = y / TILE_SIZE * p->tiles_x + i;
+    if (p->tiles[tile])
     {
-      pix = p->fbuffer + ((p->height - i - 1) * p->width + j);
-      row[j * 3 + 0] = pix->r;
-      row[j * 3 + 1] = pix->g;
-      row[j * 3 + 2] = pix->b;
+      pig_raster_resolve(p, tile);
     }
+  }
+}
+
+pixel_t
+pig_pixel(pig_t * p, puint16_t x, puint16_t y)
+{
+  pixel_t px;
+  puint32_t tile;
+  puint8_t * c;
 
-    png_write_row(png_ptr, row);
+  tile = y / TILE_SIZE * p->tiles_x + x / TILE_SIZE;
+  if (p->tiles[tile])
+  {
+    pig_raster_resolve(p, tile);
   }
 
-  png_write_end(png_ptr, NULL);
+  c = (puint8_t*)(p->color + (size_t)y * p->stride + x);
+  px.r = c[0];
+  px.g = c[1];
+  px.b = c[2];
+  px.a = c[3];
+  px.depth = p->depth[(size_t)y * p->stride + x];
+
+  return px;
+}
 
-  fclose(fout);
-  free(row);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
+puint8_t *
+pig_color_row(pig_t * p, puint16_t y)
+{
+  resolve_row(p, y);
+  return (puint8_t*)(p->color + (size_t)y * p->stride);
+}
+
+float *
+pig_depth_row(pig_t * p, puint16_t y)
+{
+  resolve_row(p, y);
+  return p->depth + (size_t)y * p->stride;
 }
@@ -26,6 +26,8 @@ THE SOFTWARE.
 
 #include "types.h"
 #include "vecmath.h"
+#include "texture.h"
+#include "output.h"
 
 /* Renderer settings */
 typedef enum
@@ -34,24 +36,91 @@ typedef enum
   RM_COLOR = (1 << 0),
   /* Fill only with texture data */
   RM_TEXTURE = (1 << 1),
-  /* Lambert Shading */
+  /* Lambert Shading, the fill is lit once per vertex */
   RM_LAMBERT = (1 << 2),
-  /* Phong Shading */
+  /* Phong Shading, the fill is lit per pixel with interpolated normals */
   RM_PHON = (1 << 3)
 } rendermode_t;
 
+/* Buffers reset by pig_clear */
+typedef enum
+{
+  /* Clear the color plane */
+  CLEAR_COLOR = (1 << 0),
+  /* Clear the depth plane */
+  CLEAR_DEPTH = (1 << 1),
+  /* Defer the clear of each tile until it is first drawn to */
+  CLEAR_FAST = (1 << 2)
+} clearmode_t;
+
+/* Faces rejected after triangle setup */
+typedef enum
+{
+  /* Draw every face */
+  CULL_NONE = 0,
+  /* Reject front faces */
+  CULL_FRONT = (1 << 0),
+  /* Reject back faces */
+  CULL_BACK = (1 << 1)
+} cullmode_t;
+
+/* Window-space winding order of front faces */
+typedef enum
+{
+  /* Counter-clockwise triangles face the viewer */
+  FRONT_CCW = 0,
+  /* Clockwise triangles face the viewer */
+  FRONT_CW = 1
+} winding_t;
+
+/* Factors scaling the fragment (source) or framebuffer (destination) color */
+typedef enum
+{
+  BLEND_ZERO = 0,
+  BLEND_ONE = 1,
+  BLEND_SRC_ALPHA = 2,
+  BLEND_ONE_MINUS_SRC_ALPHA = 3,
+  BLEND_DST_ALPHA = 4,
+  BLEND_ONE_MINUS_DST_ALPHA = 5
+} blendfactor_t;
+
+/* Blend state, the result is src * source factor + dst * destination factor */
+typedef struct
+{
+  /* Factors of the fragment and the framebuffer, ONE and ZERO replace */
+  puint32_t src, dst;
+  /* Multiply the fragment color by its alpha before blending */
+  puint32_t premultiply;
+  /* Collect fragments in per-tile lists, blended back to front by
+   * pig_composite instead of in submission order */
+  puint32_t sorted;
+} blend_t;
+
 /* Vertex data */
 typedef struct
 {
   /* Vertex position */
   float x, y, z;
-  /* Color */
-  float r, g, b;
+  /* Color and opacity */
+  float r, g, b, a;
   /* Texture coordinate */
   float u, v;
+  /* Normal, does not have to be unit length */
+  float nx, ny, nz;
 } vertex_t;
 
-/* Framebuffer pixel */
+/* Directional light */
+typedef struct
+{
+  /* Direction towards the light, in the same space as the normals */
+  vec dir;
+  /* Intensity of the ambient term */
+  float ambient;
+  /* Intensity of the diffuse term */
+  float diffuse;
+} light_t;
+
+/* Framebuffer pixel, as returned by pig_pixel */
 typedef struct
 {
   puint8_t r;
@@ -59,7 +128,7 @@ typedef struct
   puint8_t b;
   puint8_t a;
   float depth;
-} __attribute__ ((__packed__)) pixel_t;
+} pixel_t;
 
 /* Renderer state */
 typedef struct
@@ -68,23 +137,104 @@ typedef struct
   puint16_t width;
   /* Viewport height */
   puint16_t height;
-  /* Framebuffer */
-  pixel_t * fbuffer;
+  /* Color plane, RGBA8 packed into a word per pixel */
+  puint32_t * color;
+  /* Depth plane */
+  float * depth;
+  /* Distance between rows of the planes in pixels, rows are 64-byte aligned */
+  puint32_t stride;
+  /* Number of screen tiles on each axis */
+  puint32_t tiles_x, tiles_y;
+  /* Pending fast clears of each tile, CLEAR_COLOR | CLEAR_DEPTH */
+  puint8_t * tiles;
+  /* Values written by pending fast clears */
+  puint32_t clear_color;
+  float clear_depth;
+  /* Samples per pixel, 1 or 4, see pig_set_samples */
+  puint32_t samples;
+  /* Planes of 4x multisampling, four color and four depth planes laid out
+   * like the color and depth planes, which receive the resolved image */
+  puint32_t * sample_color;
+  float * sample_depth;
+  /* Set for pixels whose samples all share the color of the first plane */
+  puint8_t * sample_full;
+  /* Hierarchical Z buffer, farthest depth of each 8x8 block and tile */
+  float * hiz_block;
+  float * hiz_tile;
+  /* Number of triangles and tiles rejected by the hierarchical Z test */
+  puint32_t culled_tris;
+  puint32_t culled_tiles;
+  /* Number of triangles rejected by face culling or for covering no pixel */
+  puint32_t culled_faces;
+  /* Faces to reject, CULL_FRONT | CULL_BACK */
+  puint32_t cull;
+  /* Winding order of front faces */
+  puint32_t front;
   /* MPV matrix */
   mat m_mvp;
-  /* Current texture data */
-  puint8_t * tex_data;
-  /* Current texture width */
-  puint16_t tex_width;
-  /* Current texture height */
-  puint16_t tex_height;
+  /* Clip space y is scaled, then offset by w, so that a band of a taller
+   * image covers the viewport, see pig_render_banded */
+  float band_scale, band_offset;
+  /* Bound texture, owned by the caller */
+  pig_texture_t * texture;
+  /* Light of RM_LAMBERT and RM_PHON */
+  light_t light;
   /* Texture rendering mode */
   puint32_t mode;
+  /* Blending of fragments with the framebuffer */
+  blend_t blend;
+  /* Lines are depth tested and write their depth if non-zero */
+  puint32_t line_depth;
+  /* Number of rendering threads, triangles are binned into tiles if > 1 */
+  puint32_t threads;
+  /* Worker threads of binned rendering */
+  struct pool * pool;
+  /* Post-transform vertex buffer of indexed draws, reused between calls */
+  void * xverts;
+  puint32_t xverts_size;
+  /* Fragment lists of each tile, allocated by the first sorted draw */
+  void * frags;
+  /* Set when the last draw or composite ran out of memory and dropped
+   * geometry, which its return value reports as zero */
+  puint32_t failed;
+  /* Encoder thread and frame queue of pig_submit, see pig_set_frames */
+  struct exporter * exporter;
+  /* Own color plane while a buffer of the caller is bound, see
+   * pig_bind_color. Bound planes are pig_color_size bytes, rows run bottom
+   * to top stride pixels apart and pig_flush makes them readable. */
+  puint32_t * color_own;
+  /* Size of the bound color plane if it was mapped by pig_map_color */
+  size_t color_map;
 } pig_t;
 
+/* Draws the scene, called by pig_render_banded once per band */
+typedef void (*pig_draw_fn)(pig_t *, void *);
+
 pig_t * pig_init(puint16_t, puint16_t);
-void pig_triangle(pig_t *, vertex_t *, puint32_t);
+void pig_clear(pig_t *, puint32_t, puint32_t, float);
+int pig_triangle(pig_t *, vertex_t *, puint32_t);
+int pig_draw_indexed(pig_t *, vertex_t *, puint32_t, puint32_t *, puint32_t);
+int pig_lines(pig_t *, vertex_t *, puint32_t);
+int pig_wireframe(pig_t *, vertex_t *, puint32_t, puint32_t *, puint32_t);
+void pig_bind_texture(pig_t *, pig_texture_t *);
+int pig_composite(pig_t *);
+int pig_set_samples(pig_t *, puint32_t);
+void pig_resolve(pig_t *);
+int pig_write(pig_t *, pig_output_t *);
+void pig_flush(pig_t *);
+size_t pig_color_size(pig_t *);
+int pig_bind_color(pig_t *, puint32_t *);
+int pig_map_color(pig_t *, const char *, int);
+int pig_set_frames(pig_t *, puint32_t);
+puint32_t pig_submit(pig_t *, pig_output_t *);
+void pig_wait(pig_t *, puint32_t);
+int pig_done(pig_t *, puint32_t);
 void pig_show(pig_t *);
+int pig_render_banded(pig_output_t *, puint32_t, puint32_t, puint32_t,
+                      pig_draw_fn, void *);
+pixel_t pig_pixel(pig_t *, puint16_t, puint16_t);
+puint8_t * pig_color_row(pig_t *, puint16_t);
+float * pig_depth_row(pig_t *, puint16_t);
 void pig_free(pig_t *);
 
 #endif /*__PIG_PIG_H__*/
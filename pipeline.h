@@ -0,0 +1,139 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+/*
+ * Pipeline table template
+ * Included by rasterizer.c once per write stage, with SPAN_WRITE and
+ * SPAN_SUFFIX defined. Generates the span kernels of every fill and lighting
+ * stage from span.h, along with their tables spans_SUFFIX_sse2,
+ * spans_SUFFIX_avx2 and spans_SUFFIX_msaa indexed by [fill][light]. There is
+ * no include guard.
+ */
+
+#define PIPELINE_FN(name, isa) SPAN_CAT(SPAN_CAT(name, SPAN_SUFFIX), isa)
+
+#define SPAN_NAME  SPAN_CAT(span_color, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_COLOR
+#define SPAN_LIGHT LIGHT_NONE
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_color_lambert, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_COLOR
+#define SPAN_LIGHT LIGHT_LAMBERT
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_color_phong, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_COLOR
+#define SPAN_LIGHT LIGHT_PHONG
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_nearest, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_NEAREST
+#define SPAN_LIGHT LIGHT_NONE
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_nearest_lambert, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_NEAREST
+#define SPAN_LIGHT LIGHT_LAMBERT
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_nearest_phong, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_NEAREST
+#define SPAN_LIGHT LIGHT_PHONG
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_bilinear, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_BILINEAR
+#define SPAN_LIGHT LIGHT_NONE
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_bilinear_lambert, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_BILINEAR
+#define SPAN_LIGHT LIGHT_LAMBERT
+#include "span.h"
+
+#define SPAN_NAME  SPAN_CAT(span_bilinear_phong, SPAN_SUFFIX)
+#define SPAN_FILL  FILL_BILINEAR
+#define SPAN_LIGHT LIGHT_PHONG
+#include "span.h"
+
+static span_fn SPAN_CAT(SPAN_CAT(spans, SPAN_SUFFIX), _sse2)[FILLS][LIGHTS] =
+{
+  {
+    PIPELINE_FN(span_color, _sse2),
+    PIPELINE_FN(span_color_lambert, _sse2),
+    PIPELINE_FN(span_color_phong, _sse2)
+  },
+  {
+    PIPELINE_FN(span_nearest, _sse2),
+    PIPELINE_FN(span_nearest_lambert, _sse2),
+    PIPELINE_FN(span_nearest_phong, _sse2)
+  },
+  {
+    PIPELINE_FN(span_bilinear, _sse2),
+    PIPELINE_FN(span_bilinear_lambert, _sse2),
+    PIPELINE_FN(span_bilinear_phong, _sse2)
+  }
+};
+
+static span_fn SPAN_CAT(SPAN_CAT(spans, SPAN_SUFFIX), _avx2)[FILLS][LIGHTS] =
+{
+  {
+    PIPELINE_FN(span_color, _avx2),
+    PIPELINE_FN(span_color_lambert, _avx2),
+    PIPELINE_FN(span_color_phong, _avx2)
+  },
+  {
+    PIPELINE_FN(span_nearest, _avx2),
+    PIPELINE_FN(span_nearest_lambert, _avx2),
+    PIPELINE_FN(span_nearest_phong, _avx2)
+  },
+  {
+    PIPELINE_FN(span_bilinear, _avx2),
+    PIPELINE_FN(span_bilinear_lambert, _avx2),
+    PIPELINE_FN(span_bilinear_phong, _avx2)
+  }
+};
+
+static span_fn SPAN_CAT(SPAN_CAT(spans, SPAN_SUFFIX), _msaa)[FILLS][LIGHTS] =
+{
+  {
+    PIPELINE_FN(span_color, _msaa),
+    PIPELINE_FN(span_color_lambert, _msaa),
+    PIPELINE_FN(span_color_phong, _msaa)
+  },
+  {
+    PIPELINE_FN(span_nearest, _msaa),
+    PIPELINE_FN(span_nearest_lambert, _msaa),
+    PIPELINE_FN(span_nearest_phong, _msaa)
+  },
+  {
+    PIPELINE_FN(span_bilinear, _msaa),
+    PIPELINE_FN(span_bilinear_lambert, _msaa),
+    PIPELINE_FN(span_bilinear_phong, _msaa)
+  }
+};
+
+#undef PIPELINE_FN
+#undef SPAN_SUFFIX
+#undef SPAN_WRITE
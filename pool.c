@@ -0,0 +1,223 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+struct pool
+{
+  /* Worker threads */
+  pthread_t * threads;
+  /* Number of worker threads, the caller of pool_run is not included */
+  puint32_t count;
+  /* Thread count the pool was created for, count may fall short of it */
+  puint32_t requested;
+  /* Guards the job state */
+  pthread_mutex_t lock;
+  /* Signalled when a job is posted or the pool shuts down */
+  pthread_cond_t start;
+  /* Signalled when the last worker finishes a job */
+  pthread_cond_t done;
+  /* Job function and argument */
+  pool_fn fn;
+  void * arg;
+  /* Number of tasks in the job */
+  puint32_t tasks;
+  /* Next task to be picked up */
+  puint32_t next;
+  /* Incremented whenever a job is posted */
+  puint32_t job;
+  /* Number of workers still running the job */
+  puint32_t busy;
+  /* Set when the workers should exit */
+  int quit;
+};
+
+/**
+ * Runs tasks of the current job until none are left
+ */
+static void
+pool_work(pool_t * pool)
+{
+  puint32_t i;
+
+  while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->tasks)
+  {
+    pool->fn(pool->arg, i);
+  }
+}
+
+/**
+ * Worker thread, waits for jobs and helps running them
+ */
+static void *
+pool_worker(void * data)
+{
+  pool_t * pool = (pool_t*)data;
+  puint32_t job = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    while (!pool->quit && pool->job == job)
+    {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+
+    if (pool->quit)
+    {
+      break;
+    }
+
+    job = pool->job;
+    pthread_mutex_unlock(&pool->lock);
+    pool_work(pool);
+    pthread_mutex_lock(&pool->lock);
+
+    if (--pool->busy == 0)
+    {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+pool_t *
+pool_create(puint32_t threads)
+{
+  pool_t * pool;
+
+  if (!(pool = (pool_t*)malloc(sizeof(pool_t))))
+  {
+    return NULL;
+  }
+
+  pool->count = 0;
+  pool->requested = threads;
+  pool->fn = NULL;
+  pool->arg = NULL;
+  pool->tasks = 0;
+  pool->next = 0;
+  pool->job = 0;
+  pool->busy = 0;
+  pool->quit = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  /* The thread calling pool_run does work as well */
+  threads = threads > 1 ? threads - 1 : 0;
+  if (!(pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * (threads + 1))))
+  {
+    pool_free(pool);
+    return NULL;
+  }
+
+  for (; pool->count < threads; ++pool->count)
+  {
+    if (pthread_create(&pool->threads[pool->count], NULL, pool_worker, pool))
+    {
+      break;
+    }
+  }
+
+  return pool;
+}
+
+puint32_t
+pool_size(pool_t * pool)
+{
+  return pool ? pool->count + 1 : 1;
+}
+
+puint32_t
+pool_requested(pool_t * pool)
+{
+  return pool ? pool->requested : 1;
+}
+
+void
+pool_run(pool_t * pool, pool_fn fn, void * arg, puint32_t tasks)
+{
+  puint32_t i;
+
+  /* Nothing to share, run on the calling thread */
+  if (!pool || pool->count == 0 || tasks <= 1)
+  {
+    for (i = 0; i < tasks; ++i)
+    {
+      fn(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->tasks = tasks;
+  pool->next = 0;
+  pool->busy = pool->count;
+  pool->job++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  pool_work(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy)
+  {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+pool_free(pool_t * pool)
+{
+  puint32_t i;
+
+  if (!pool)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->count; ++i)
+  {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
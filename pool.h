@@ -0,0 +1,41 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#ifndef __PIG_POOL_H__
+#define __PIG_POOL_H__
+
+#include "types.h"
+
+/* Worker thread pool */
+typedef struct pool pool_t;
+
+/* Job run by the pool, called with the job argument and a task index */
+typedef void (*pool_fn)(void *, puint32_t);
+
+pool_t * pool_create(puint32_t);
+puint32_t pool_size(pool_t *);
+puint32_t pool_requested(pool_t *);
+void pool_run(pool_t *, pool_fn, void *, puint32_t);
+void pool_free(pool_t *);
+
+#endif /*__PIG_POOL_H__*/
@@ -22,20 +22,42 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 *******************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
-#include <emmintrin.h>
+#include <string.h>
+#include <immintrin.h>
+#include "pool.h"
 #include "rasterizer.h"
 
+/**
+ * Window coordinates are snapped to a grid of 1 / 2^SUBPIXEL_BITS pixels
+ */
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_SCALE (1 << SUBPIXEL_BITS)
+
+/**
+ * Sample positions of 4x multisampling on a rotated grid, relative to the
+ * pixel center in 1 / 16 pixels, which fall on the sub-pixel grid
+ */
+static const int sample_x[4] = { -2, 6, -6, 2 };
+static const int sample_y[4] = { -6, -2, 2, 6 };
+
 typedef struct
 {
-  /* Window coordinates */
-  pint16_t x, y;
+  /* Window coordinates, 28.4 fixed point */
+  pint32_t x, y;
   /* Depth in [-1, 1] range */
   float z;
-  /* Vertex color */
-  float r, g, b;
+  /* Reciprocal of the clip-space w */
+  float w;
+  /* Vertex color and opacity */
+  float r, g, b, a;
   /* Texture coordinates */
   float u, v;
+  /* Normal */
+  float nx, ny, nz;
+  /* Light intensity of Lambert shading */
+  float l;
 } frag_t;
 
 static int
@@ -50,224 +72,2825 @@ max(int a, int b)
   return a > b ? a : b;
 }
 
+static float
+min_f(float a, float b)
+{
+  return a < b ? a : b;
+}
+
+static float
+max_f(float a, float b)
+{
+  return a > b ? a : b;
+}
+
+/**
+ * Rounds towards negative infinity
+ */
+static int
+ifloor(float f)
+{
+  int i = (int)f;
+
+  return i - (f < i);
+}
+
+/**
+ * Wraps a texel coordinate into [0, size)
+ */
+static int
+wrap(int c, int size, int pot)
+{
+  if (pot)
+  {
+    return c & (size - 1);
+  }
+
+  c %= size;
+  return c < 0 ? c + size : c;
+}
+
+/**
+ * Address of a texel in a mipmap level
+ */
+static puint8_t *
+texel_addr(pig_texture_t * t, pig_level_t * l, int x, int y)
+{
+  return l->data + PIG_TEXEL_OFFSET(t, l, x, y);
+}
+
+/**
+ * Texture lookup in a mipmap level, coordinates wrap around
+ * Texels are RGBA8, so they come out packed as in the framebuffer.
+ */
+static puint32_t
+texel_fetch(pig_texture_t * t, int lod, float u, float v)
+{
+  pig_level_t * l = &t->level[lod];
+
+  return *(puint32_t*)texel_addr(t, l,
+                                 wrap(ifloor(u * l->width), l->width, l->pot),
+                                 wrap(ifloor(v * l->height), l->height, l->pot));
+}
+
+/**
+ * Edge function e(x, y) = a * x + b * y + c of pixel coordinates, positive
+ * inside the triangle. Values are exact, scaled by 2^(2 * SUBPIXEL_BITS).
+ */
+typedef struct
+{
+  int a, b;
+  pint64_t c;
+} edge_t;
+
+/**
+ * Attribute plane equation f(x, y) = dx * x + dy * y + c
+ */
+typedef struct
+{
+  float dx, dy, c;
+} plane_t;
+
+/**
+ * Margin for the rounding of interpolated depth in hierarchical Z tests
+ */
+#define HIZ_EPSILON 1e-6f
+
+/**
+ * Number of triangles set up by a front end task
+ */
+#define SETUP_BATCH 256
+
+/**
+ * Number of vertices of non-indexed draws transformed at once
+ */
+#define VERTEX_BATCH 48
+
+/**
+ * Triangles with a bounding box of at most this many pixels are checked for
+ * coverage during setup instead of walking them
+ */
+#define SMALL_TRI_AREA 16
+
+/**
+ * Edge function values handed to the span kernels are clamped to this range
+ * Clamping keeps the sign of the first lanes of a block, since the coordinate
+ * range allowed by the guard band bounds 8 * a well below it.
+ */
+#define EDGE_CLAMP (1 << 30)
+
 /**
- * Texture lookup
+ * Sets up the edge function between two vertices
  */
 static void
-texel_fetch(pig_t * p, frag_t * f, puint8_t * r, puint8_t * g, puint8_t * b)
+setup_edge(edge_t * e, frag_t * v0, frag_t * v1)
 {
-  float u, v;
-  puint16_t x, y;
-  puint8_t * px;
+  e->a = (v0->y - v1->y) * SUBPIXEL_SCALE;
+  e->b = (v1->x - v0->x) * SUBPIXEL_SCALE;
+  e->c = (pint64_t)v0->x * v1->y - (pint64_t)v0->y * v1->x;
+}
+
+/**
+ * Evaluates an edge function at a pixel
+ */
+static pint64_t
+edge_eval(edge_t * e, int x, int y)
+{
+  return (pint64_t)e->a * x + (pint64_t)e->b * y + e->c;
+}
+
+/**
+ * Evaluates an edge function at a pixel, clamped to 32 bits for the kernels
+ */
+static int
+edge_clamp(edge_t * e, int x, int y)
+{
+  pint64_t w = edge_eval(e, x, y);
 
-  u = f->u - floor(f->u);
-  v = f->v - floor(f->v);
-  x = (puint16_t)(u * p->tex_width) % p->tex_width;
-  y = (puint16_t)(v * p->tex_height) % p->tex_height;
-  px = p->tex_data + (((y * p->tex_width) + x) << 2);
+  return w < -EDGE_CLAMP ? -EDGE_CLAMP : (w > EDGE_CLAMP ? EDGE_CLAMP : w);
+}
 
-  *r = px[0];
-  *g = px[1];
-  *b = px[2];
+/**
+ * Top-left fill rule: pixels lying exactly on an edge are only covered if
+ * the edge is a top or a left one, so triangles sharing an edge never touch
+ * the same pixel twice. The framebuffer is y-up, thus the interior of top
+ * edges is below them.
+ */
+static int
+is_top_left(edge_t * e)
+{
+  return e->a > 0 || (e->a == 0 && e->b < 0);
 }
 
 /**
- * Emits a single fragment
+ * Sets up the plane equation of an attribute from its vertex values
+ * The plane passes through the value of the first vertex at (x, y), which
+ * avoids large constant terms far away from the origin.
  */
 static void
-emit_fragment(pig_t * p, frag_t * f)
+setup_plane(plane_t * p, edge_t * e, float det, float x, float y,
+            float a, float b, float c)
+{
+  p->dx = ((b - a) * e[1].a + (c - a) * e[2].a) / det;
+  p->dy = ((b - a) * e[1].b + (c - a) * e[2].b) / det;
+  p->c = a - p->dx * x - p->dy * y;
+}
+
+/**
+ * Triangle set up for rasterization
+ */
+typedef struct
+{
+  /* Edge functions, biased by the fill rule */
+  edge_t e[3];
+  /* Attribute planes, all except z and w are divided by the clip-space w */
+  plane_t z, w, u, v, r, g, b, a;
+  /* Normal planes of Phong shading, light plane of Lambert shading */
+  plane_t nx, ny, nz, l;
+  /* Bounding box, clamped to the viewport */
+  int minx, miny, maxx, maxy;
+  /* Nearest depth, lowered by HIZ_EPSILON */
+  float zmin;
+} tri_t;
+
+/**
+ * Pixels of a span kernel group, handed to the shading stages
+ */
+typedef struct
+{
+  /* Lower left pixel, number of lanes and the lanes to shade */
+  int x, y, n, mask;
+  /* Perspective-correct texture coordinates, w and depth of each lane */
+  float u[8], v[8], w[8], z[8];
+  /* Shaded colors, packed as in the framebuffer */
+  puint32_t color[8];
+  /* Samples covered by each lane under multisampling */
+  puint8_t samples[8];
+} group_t;
+
+/**
+ * Span kernel, renders pixels [x0, x1] of row y, which lie in a single block
+ * The last argument is non-zero if the block is fully inside the triangle
+ */
+typedef void (*span_fn)(pig_t *, tri_t *, int, int, int, int);
+
+/**
+ * Evaluates a plane equation at a pixel
+ */
+static float
+plane_at(plane_t * p, int x, int y)
+{
+  return p->dx * x + p->dy * y + p->c;
+}
+
+/**
+ * Mipmap level of the 2x2 quad whose lower left pixel is (x, y)
+ * Derivatives are taken between the texture coordinates of the quad's
+ * pixels, the level is log2 of the larger one rounded to the nearest.
+ */
+static int
+texture_lod(pig_t * p, tri_t * t, int x, int y)
 {
-  pixel_t * px;
-  puint8_t r, g, b;
+  pig_texture_t * tex = p->texture;
+  float u0, v0, u1, v1, u2, v2, w, dux, dvx, duy, dvy;
+  union { float f; puint32_t i; } rho;
+  int e;
 
-  /* Make sure the fragment is in the viewport */
-  if (f->x < 0 || p->width < f->x ||
-      f->y < 0 || p->height < f->y ||
-      f->z < 0.0f || 1.0f < f->z)
+  if (tex->levels == 1)
   {
-    return;
+    return 0;
   }
 
-  /* Depth test */
-  px = p->fbuffer + ((f->y * p->width) + f->x);
-  if (px->depth < f->z) {
-    return;
+  w = 1.0f / plane_at(&t->w, x, y);
+  u0 = plane_at(&t->u, x, y) * w;
+  v0 = plane_at(&t->v, x, y) * w;
+  w = 1.0f / plane_at(&t->w, x + 1, y);
+  u1 = plane_at(&t->u, x + 1, y) * w;
+  v1 = plane_at(&t->v, x + 1, y) * w;
+  w = 1.0f / plane_at(&t->w, x, y + 1);
+  u2 = plane_at(&t->u, x, y + 1) * w;
+  v2 = plane_at(&t->v, x, y + 1) * w;
+
+  dux = (u1 - u0) * tex->width;
+  dvx = (v1 - v0) * tex->height;
+  duy = (u2 - u0) * tex->width;
+  dvy = (v2 - v0) * tex->height;
+  rho.f = max_f(dux * dux + dvx * dvx, duy * duy + dvy * dvy);
+
+  /* rho lies in [2^(e - 1), 2^e), so round(log2(sqrt(rho))) is e / 2 */
+  e = (int)((rho.i >> 23) & 0xFF) - 126;
+  return e <= 0 ? 0 : min(e / 2, tex->levels - 1);
+}
+
+/**
+ * Linear interpolation of 16-bit channels, weights are in [0, 256]
+ */
+static __m128i
+lerp_epu16(__m128i a, __m128i b, __m128i w)
+{
+  return _mm_srli_epi16(_mm_add_epi16(
+    _mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), w)),
+    _mm_mullo_epi16(b, w)
+  ), 8);
+}
+
+/**
+ * Spreads the 16-bit weights of four pixels over their four channels
+ * The first two pixels end up in lo, the last two in hi, matching the
+ * channels of the pixels unpacked to 16 bits.
+ */
+static void
+spread_weights(__m128i w, __m128i * lo, __m128i * hi)
+{
+  w = _mm_packs_epi32(w, w);
+  w = _mm_unpacklo_epi16(w, w);
+  *lo = _mm_unpacklo_epi32(w, w);
+  *hi = _mm_unpackhi_epi32(w, w);
+}
+
+/**
+ * Bilinear filtering of the four pixels starting at (x, y)
+ * Texel coordinates and weights are computed for all pixels at once. The
+ * four corners around each sample are gathered into one register per
+ * corner, then all 16 channels are blended with SSE2 integer math.
+ */
+static void
+shade_bilinear(pig_t * p, tri_t * t, int x, int y, int mask,
+               float * us, float * vs, puint32_t * color)
+{
+  pig_texture_t * tex = p->texture;
+  pig_level_t * l[4];
+  puint32_t c00[4], c10[4], c01[4], c11[4];
+  int ix[4], iy[4], x0, y0, x1, y1, i;
+  __m128 fx, fy, half;
+  __m128i xi, yi, wx, wy, wxl, wxh, wyl, wyh, zero, a, b, lo, hi;
+
+  /* Pixel pairs lie in the same quad and share a mipmap level */
+  for (i = 0; i < 4; i += 2)
+  {
+    l[i] = &tex->level[mask & (3 << i) ? texture_lod(p, t, x + i, y & ~1) : 0];
+    l[i + 1] = l[i];
   }
 
-  /* Lookup texture */
-  if (p->mode == RM_TEXTURE)
+  /* Texel space coordinates, texel centers lie at half-integers */
+  half = _mm_set1_ps(0.5f);
+  fx = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(us), _mm_set_ps(
+    l[3]->width, l[2]->width, l[1]->width, l[0]->width)), half);
+  fy = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(vs), _mm_set_ps(
+    l[3]->height, l[2]->height, l[1]->height, l[0]->height)), half);
+
+  /* Round down, the fractions become weights */
+  xi = _mm_cvttps_epi32(fx);
+  xi = _mm_add_epi32(xi, _mm_castps_si128(
+    _mm_cmplt_ps(fx, _mm_cvtepi32_ps(xi))));
+  yi = _mm_cvttps_epi32(fy);
+  yi = _mm_add_epi32(yi, _mm_castps_si128(
+    _mm_cmplt_ps(fy, _mm_cvtepi32_ps(yi))));
+  wx = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(fx, _mm_cvtepi32_ps(xi)),
+                                  _mm_set1_ps(256.0f)));
+  wy = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(fy, _mm_cvtepi32_ps(yi)),
+                                  _mm_set1_ps(256.0f)));
+  _mm_storeu_si128((__m128i*)ix, xi);
+  _mm_storeu_si128((__m128i*)iy, yi);
+
+  /* Gather the corners */
+  for (i = 0; i < 4; ++i)
   {
-    texel_fetch(p, f, &r, &g, &b);
+    x0 = wrap(ix[i], l[i]->width, l[i]->pot);
+    y0 = wrap(iy[i], l[i]->height, l[i]->pot);
+    x1 = wrap(ix[i] + 1, l[i]->width, l[i]->pot);
+    y1 = wrap(iy[i] + 1, l[i]->height, l[i]->pot);
+    c00[i] = *(puint32_t*)texel_addr(tex, l[i], x0, y0);
+    c10[i] = *(puint32_t*)texel_addr(tex, l[i], x1, y0);
+    c01[i] = *(puint32_t*)texel_addr(tex, l[i], x0, y1);
+    c11[i] = *(puint32_t*)texel_addr(tex, l[i], x1, y1);
   }
-  else
+
+  spread_weights(wx, &wxl, &wxh);
+  spread_weights(wy, &wyl, &wyh);
+
+  /* Blend the rows, then the columns */
+  zero = _mm_setzero_si128();
+  a = _mm_loadu_si128((__m128i*)c00);
+  b = _mm_loadu_si128((__m128i*)c10);
+  lo = lerp_epu16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), wxl);
+  hi = lerp_epu16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), wxh);
+  a = _mm_loadu_si128((__m128i*)c01);
+  b = _mm_loadu_si128((__m128i*)c11);
+  lo = lerp_epu16(lo, lerp_epu16(_mm_unpacklo_epi8(a, zero),
+                                 _mm_unpacklo_epi8(b, zero), wxl), wyl);
+  hi = lerp_epu16(hi, lerp_epu16(_mm_unpackhi_epi8(a, zero),
+                                 _mm_unpackhi_epi8(b, zero), wxh), wyh);
+
+  _mm_storeu_si128((__m128i*)color, _mm_packus_epi16(lo, hi));
+}
+
+/**
+ * Evaluates a plane divided by w for the four pixels starting at (x, y)
+ */
+static __m128
+plane_lanes(plane_t * p, int x, int y, float * ws)
+{
+  __m128 xf;
+
+  xf = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x),
+                                     _mm_set_epi32(3, 2, 1, 0)));
+  return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xf, _mm_set1_ps(p->dx)),
+                               _mm_set1_ps(p->dy * y + p->c)),
+                    _mm_loadu_ps(ws));
+}
+
+/**
+ * Interpolated vertex colors of the four pixels starting at (x, y)
+ */
+static void
+vertex_color(tri_t * t, int x, int y, float * ws, puint32_t * color)
+{
+  __m128 zero, one, scale;
+  __m128i r, g, b, a;
+
+  zero = _mm_setzero_ps();
+  one = _mm_set1_ps(1.0f);
+  scale = _mm_set1_ps(255.0f);
+  r = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+    plane_lanes(&t->r, x, y, ws), zero), one), scale));
+  g = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+    plane_lanes(&t->g, x, y, ws), zero), one), scale));
+  b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+    plane_lanes(&t->b, x, y, ws), zero), one), scale));
+  a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+    plane_lanes(&t->a, x, y, ws), zero), one), scale));
+
+  _mm_storeu_si128((__m128i*)color, _mm_or_si128(
+    _mm_or_si128(r, _mm_slli_epi32(g, 8)),
+    _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24))));
+}
+
+/**
+ * Diffuse lighting of n normals, stored in 16-byte aligned arrays
+ * The normals are normalized in place, intensities are written to l.
+ */
+static void
+light_batch(pig_t * p, float * l, float * nx, float * ny, float * nz, int n)
+{
+  __m128 ambient, diffuse;
+  vec dir;
+  int i;
+
+  dir = p->light.dir;
+  dir.w = 0.0f;
+  vec_norm(&dir);
+  vec_norm_batch(nx, ny, nz, n);
+  vec_dot_batch(l, nx, ny, nz, &dir, n);
+
+  ambient = _mm_set1_ps(p->light.ambient);
+  diffuse = _mm_set1_ps(p->light.diffuse);
+  for (i = 0; i < n; i += 4)
   {
-    r = 0;
-    g = 0;
-    b = 0;
+    _mm_store_ps(l + i, _mm_add_ps(ambient, _mm_mul_ps(diffuse, _mm_max_ps(
+      _mm_load_ps(l + i), _mm_setzero_ps()))));
   }
+}
+
+/**
+ * Scales the colors of four pixels by their light intensities
+ * Alpha is left as it is, only the color is lit.
+ */
+static void
+modulate(puint32_t * color, float * l)
+{
+  __m128i w, lo, hi, c, zero, rgb, alpha;
 
-  /* Write the fragment */
-  px->r = r;
-  px->g = g;
-  px->b = b;
-  px->depth = f->z;
+  w = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+    _mm_load_ps(l), _mm_setzero_ps()), _mm_set1_ps(1.0f)),
+    _mm_set1_ps(256.0f)));
+  spread_weights(w, &lo, &hi);
+  rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  alpha = _mm_set_epi16(256, 0, 0, 0, 256, 0, 0, 0);
+  lo = _mm_or_si128(_mm_and_si128(lo, rgb), alpha);
+  hi = _mm_or_si128(_mm_and_si128(hi, rgb), alpha);
+
+  zero = _mm_setzero_si128();
+  c = _mm_loadu_si128((__m128i*)color);
+  lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), lo), 8);
+  hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), hi), 8);
+  _mm_storeu_si128((__m128i*)color, _mm_packus_epi16(lo, hi));
 }
 
 /**
- * Bresenham's line algorithm
+ * Fill stage, interpolated vertex colors
  */
 static void
-emit_line(pig_t * p, frag_t * p0, frag_t * p1)
+fill_color(tri_t * t, group_t * g)
 {
-  int dx, dy, sx, sy, err, e;
-  frag_t f;
+  int i;
+
+  for (i = 0; i < g->n; i += 4)
+  {
+    vertex_color(t, g->x + i, g->y, g->w + i, g->color + i);
+  }
+}
 
-  dx = abs(p1->x - p0->x);
-  dy = abs(p1->y - p0->y);
-  sx = p1->x < p0->x ? -1 : 1;
-  sy = p1->y < p0->y ? -1 : 1;
-  err = dx - dy;
-  f = *p0;
+/**
+ * Fill stage, nearest texel of the bound texture
+ */
+static void
+fill_nearest(pig_t * p, tri_t * t, group_t * g)
+{
+  int i, lod = 0;
 
-  while (1)
+  for (i = 0; i < g->n; ++i)
   {
-    emit_fragment(p, &f);
-    if (f.x == p1->x && f.y == p1->y)
+    /* Lanes come in pairs from the same quad, x is a multiple of 4 */
+    if (!(i & 1) && (g->mask & (3 << i)))
     {
-      break;
+      lod = texture_lod(p, t, g->x + i, g->y & ~1);
     }
-
-    e = 2 * err;
-    if (e > -dy) {
-      err -= dy;
-      f.x += sx;
+    g->color[i] = 0;
+    if (g->mask & (1 << i))
+    {
+      g->color[i] = texel_fetch(p->texture, lod, g->u[i], g->v[i]);
     }
+  }
+}
+
+/**
+ * Fill stage, bilinear filtering of the bound texture
+ */
+static void
+fill_bilinear(pig_t * p, tri_t * t, group_t * g)
+{
+  int i;
 
-    if (f.x == p1->x && f.y == p1->y)
+  for (i = 0; i < g->n; i += 4)
+  {
+    if (g->mask & (15 << i))
     {
-      emit_fragment(p, &f);
-      break;
+      shade_bilinear(p, t, g->x + i, g->y, (g->mask >> i) & 15,
+                     g->u + i, g->v + i, g->color + i);
     }
-
-    if (e < dx) {
-      err += dx;
-      f.y += sy;
+    else
+    {
+      memset(g->color + i, 0, sizeof(puint32_t) * 4);
     }
   }
 }
 
-static int
-orient(frag_t * a, frag_t * b, frag_t * c)
+/**
+ * Lighting stage of Lambert shading, interpolates the vertex lighting
+ */
+static void
+light_lambert(tri_t * t, group_t * g)
+{
+  float l[8] __attribute__ ((__aligned__ (16)));
+  int i;
+
+  for (i = 0; i < g->n; i += 4)
+  {
+    _mm_store_ps(l + i, plane_lanes(&t->l, g->x + i, g->y, g->w + i));
+    modulate(g->color + i, l + i);
+  }
+}
+
+/**
+ * Lighting stage of Phong shading, lights the interpolated normals
+ */
+static void
+light_phong(pig_t * p, tri_t * t, group_t * g)
+{
+  float nx[8] __attribute__ ((__aligned__ (16)));
+  float ny[8] __attribute__ ((__aligned__ (16)));
+  float nz[8] __attribute__ ((__aligned__ (16)));
+  float l[8] __attribute__ ((__aligned__ (16)));
+  int i;
+
+  for (i = 0; i < g->n; i += 4)
+  {
+    _mm_store_ps(nx + i, plane_lanes(&t->nx, g->x + i, g->y, g->w + i));
+    _mm_store_ps(ny + i, plane_lanes(&t->ny, g->x + i, g->y, g->w + i));
+    _mm_store_ps(nz + i, plane_lanes(&t->nz, g->x + i, g->y, g->w + i));
+  }
+  light_batch(p, l, nx, ny, nz, g->n);
+
+  for (i = 0; i < g->n; i += 4)
+  {
+    modulate(g->color + i, l + i);
+  }
+}
+
+/**
+ * Blend factors as f = 256 * k[0] + k[1] * src alpha + k[2] * dst alpha,
+ * with alphas scaled to [0, 256], indexed by blendfactor_t
+ */
+static const short blend_terms[6][3] =
+{
+  { 0,  0,  0 },
+  { 1,  0,  0 },
+  { 0,  1,  0 },
+  { 1, -1,  0 },
+  { 0,  0,  1 },
+  { 1,  0, -1 }
+};
+
+/**
+ * Blends two pixels of source and destination channels unpacked to 16 bits
+ * k holds the terms of the source and destination factors, pm selects the
+ * color channels if the source is premultiplied by its alpha.
+ */
+static __m128i
+blend_channels(__m128i s, __m128i d, __m128i * k, __m128i pm)
 {
-  return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+  __m128i sa, da, fs, fd, one;
+
+  /* Alphas of each pixel in all of its channels, scaled to [0, 256] */
+  sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+  da = _mm_shufflehi_epi16(_mm_shufflelo_epi16(d, 0xFF), 0xFF);
+  sa = _mm_add_epi16(sa, _mm_srli_epi16(sa, 7));
+  da = _mm_add_epi16(da, _mm_srli_epi16(da, 7));
+
+  one = _mm_set1_epi16(256);
+  s = _mm_srli_epi16(_mm_mullo_epi16(s, _mm_or_si128(
+    _mm_and_si128(pm, sa), _mm_andnot_si128(pm, one))), 8);
+
+  fs = _mm_add_epi16(k[0], _mm_add_epi16(_mm_mullo_epi16(k[1], sa),
+                                         _mm_mullo_epi16(k[2], da)));
+  fd = _mm_add_epi16(k[3], _mm_add_epi16(_mm_mullo_epi16(k[4], sa),
+                                         _mm_mullo_epi16(k[5], da)));
+
+  /* Products are at most 255 * 256, the sum saturates when packed */
+  return _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(s, fs), 8),
+                       _mm_srli_epi16(_mm_mullo_epi16(d, fd), 8));
 }
 
 /**
- * Triangle rasterization
+ * Blends n colors with the framebuffer pixels at dst, n is a multiple of 4
+ * The factors come from a table, so the blend state is never branched on.
  */
 static void
-emit_triangle(pig_t * p, frag_t * a, frag_t * b, frag_t * c)
+blend_pixels(pig_t * p, puint32_t * color, puint32_t * dst, int n)
 {
-  int minx = max(min(a->x, min(b->x, c->x)), 0);
-  int miny = max(min(a->y, min(b->y, c->y)), 0);
-  int maxx = min(max(a->x, max(b->x, c->x)), p->width - 1);
-  int maxy = min(max(a->y, max(b->y, c->y)), p->height - 1);
-  float det = (a->x - c->x) * (b->y - c->y) - (b->x - c->x) * (a->y - c->y);
-  float bcx = b->x - c->x, bcy = b->y - c->y;
-  float acx = a->x - c->x, acy = a->y - c->y;
-  float dx, dy, dz;
-  frag_t f;
+  const short * src_terms, * dst_terms;
+  __m128i k[6], pm, s, d, zero;
+  int i;
+
+  src_terms = blend_terms[p->blend.src];
+  dst_terms = blend_terms[p->blend.dst];
+  k[0] = _mm_set1_epi16(src_terms[0] * 256);
+  k[1] = _mm_set1_epi16(src_terms[1]);
+  k[2] = _mm_set1_epi16(src_terms[2]);
+  k[3] = _mm_set1_epi16(dst_terms[0] * 256);
+  k[4] = _mm_set1_epi16(dst_terms[1]);
+  k[5] = _mm_set1_epi16(dst_terms[2]);
+  pm = _mm_and_si128(_mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1),
+                     _mm_set1_epi16(-(short)(p->blend.premultiply != 0)));
+
+  zero = _mm_setzero_si128();
+  for (i = 0; i < n; i += 4)
+  {
+    s = _mm_loadu_si128((__m128i*)(color + i));
+    d = _mm_loadu_si128((__m128i*)(dst + i));
+    _mm_storeu_si128((__m128i*)(color + i), _mm_packus_epi16(
+      blend_channels(_mm_unpacklo_epi8(s, zero),
+                     _mm_unpacklo_epi8(d, zero), k, pm),
+      blend_channels(_mm_unpackhi_epi8(s, zero),
+                     _mm_unpackhi_epi8(d, zero), k, pm)));
+  }
+}
 
-  f.r = 1.0f;
-  f.g = 1.0f;
-  f.b = 1.0f;
+/**
+ * Write stage of sorted draws, adds the lanes of a group to its tile's list
+ */
+static void
+append_fragments(pig_t * p, group_t * g)
+{
+  pig_fraglist_t * l;
+  pig_frag_t * f;
+  int i;
 
-  for (f.y = miny; f.y <= maxy; ++f.y)
+  /* Groups never cross a block, so all lanes lie in the same tile */
+  l = (pig_fraglist_t*)p->frags + (g->y / TILE_SIZE) * p->tiles_x +
+      g->x / TILE_SIZE;
+  for (i = 0; i < g->n; ++i)
   {
-    for (f.x = minx; f.x <= maxx; ++f.x)
+    if (!(g->mask & (1 << i)))
     {
-      /* Check whether the pixel is in the triangle or not */
-      int w0 = orient(b, c, &f);
-      int w1 = orient(c, a, &f);
-      int w2 = orient(a, b, &f);
+      continue;
+    }
 
-      if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+    if (l->count == l->size)
+    {
+      f = (pig_frag_t*)realloc(l->frags, sizeof(pig_frag_t) *
+                               (l->size ? l->size * 2 : TILE_SIZE));
+      if (!f)
       {
-        /* Compute weights */
-        dx = (f.x - c->x) * bcy - (f.y - c->y) * bcx;
-        dy = acx * (f.y - c->y) - acy * (f.x - c->x);
-        dz = (a->x - f.x) * (b->y - f.y) - (a->y - f.y) * (b->x - f.x);
-        dx /= det; dy /= det; dz /= det;
-
-        /* Interpolate attributes */
-        f.z = a->z * dx + b->z * dy + c->z * dz;
-        f.u = a->u * dx + b->u * dy + c->u * dz;
-        f.v = a->v * dx + b->v * dy + c->v * dz;
-        f.r = a->r * dx + b->r * dy + c->r * dz;
-        f.g = a->g * dx + b->g * dy + c->g * dz;
-        f.b = a->b * dx + b->b * dy + c->b * dz;
-
-        /* Render the fragment */
-        emit_fragment(p, &f);
+        p->failed = 1;
+        return;
       }
+      l->frags = f;
+      l->size = l->size ? l->size * 2 : TILE_SIZE;
     }
+
+    f = &l->frags[l->count++];
+    f->color = g->color[i];
+    f->z = g->z[i];
+    f->samples = g->samples[i];
+    f->pixel = (g->y % TILE_SIZE) * TILE_SIZE + (g->x + i) % TILE_SIZE;
   }
 }
 
-/**
- * Computes the window-space coordinate of a vertex
- * Returns a non-zero value if the vertex is not clipped
+/* Fill stages of the pipelines */
+#define FILL_COLOR    0
+#define FILL_NEAREST  1
+#define FILL_BILINEAR 2
+#define FILLS         3
+
+/* Lighting stages of the pipelines */
+#define LIGHT_NONE    0
+#define LIGHT_LAMBERT 1
+#define LIGHT_PHONG   2
+#define LIGHTS        3
+
+/* Write stages of the pipelines */
+#define WRITE_OPAQUE  0
+#define WRITE_BLEND   1
+#define WRITE_SORTED  2
+#define WRITES        3
+
+#define SPAN_CAT(a, b) SPAN_CAT_(a, b)
+#define SPAN_CAT_(a, b) a ## b
+
+/*
+ * Span kernels of every pipeline, generated from pipeline.h and span.h so
+ * that the state of a draw call is never checked per pixel
  */
-static int
-transform_vertex(pig_t * p, frag_t * f, vertex_t * a)
-{
-  vec x, tmp;
-  int clipped;
+#define SPAN_WRITE  WRITE_OPAQUE
+#define SPAN_SUFFIX _opaque
+#include "pipeline.h"
 
-  /* Apply transformations */
-  x.x = a->x; x.y = a->y; x.z = a->z; x.w = 1.0f;
-  vec_mul(&tmp, &x, p->m_mvp);
+#define SPAN_WRITE  WRITE_BLEND
+#define SPAN_SUFFIX _blend
+#include "pipeline.h"
 
-  /* Clipping, return 0 if the vertex is outside the view volume */
-  clipped = -tmp.w <= tmp.x && tmp.x <= tmp.w &&
-            -tmp.w <= tmp.y && tmp.y <= tmp.w &&
-            -tmp.w <= tmp.z && tmp.z <= tmp.w &&
-            0 < tmp.w;
+#define SPAN_WRITE  WRITE_SORTED
+#define SPAN_SUFFIX _sorted
+#include "pipeline.h"
 
-  /* Get the normalized device coordinates */
-  tmp.x /= tmp.w;
-  tmp.y /= tmp.w;
-  tmp.z /= tmp.w;
+/**
+ * Pipelines indexed by write, fill and lighting stage, per instruction set
+ */
+static span_fn (*spans_sse2[WRITES])[LIGHTS] =
+{
+  spans_opaque_sse2, spans_blend_sse2, spans_sorted_sse2
+};
 
-  /* Window coordinates */
-  f->x = p->width * (tmp.x + 1.0f) / 2;
-  f->y = p->height * (tmp.y + 1.0f) / 2;
-  f->z = tmp.z;
+static span_fn (*spans_avx2[WRITES])[LIGHTS] =
+{
+  spans_opaque_avx2, spans_blend_avx2, spans_sorted_avx2
+};
 
-  /* Copy vertex attributes */
-  f->r = a->r;
-  f->g = a->g;
-  f->b = a->b;
-  f->u = a->u;
-  f->v = a->v;
+static span_fn (*spans_msaa[WRITES])[LIGHTS] =
+{
+  spans_opaque_msaa, spans_blend_msaa, spans_sorted_msaa
+};
 
-  return clipped;
-}
+/**
+ * Pipelines picked by pig_raster_init for the host CPU
+ */
+static span_fn (**spans)[LIGHTS] = NULL;
 
-void
-pig_raster_triangle(pig_t * p, vertex_t * a, vertex_t * b, vertex_t * c)
+/**
+ * Returns non-zero if the blend state replaces the framebuffer color
+ */
+static int
+blend_opaque(pig_t * p)
 {
-  frag_t f[3];
-  int clipA, clipB, clipC;
+  return p->blend.src == BLEND_ONE && p->blend.dst == BLEND_ZERO &&
+         !p->blend.premultiply;
+}
 
-  clipA = transform_vertex(p, f + 0, a);
-  clipB = transform_vertex(p, f + 1, b);
-  clipC = transform_vertex(p, f + 2, c);
+/**
+ * Picks the pipeline matching the state of a draw call
+ * The fragment lists are allocated by the first sorted draw, fragments are
+ * blended right away if that fails.
+ */
+static span_fn
+select_span(pig_t * p)
+{
+  int fill, light, write;
 
-  /* The triangle is only rasterized if at least one vertex is visible */
-  if (clipA || clipB || clipC)
+  if (!(p->mode & RM_TEXTURE) || !p->texture)
+  {
+    fill = FILL_COLOR;
+  }
+  else if (p->texture->filter == TEX_BILINEAR)
+  {
+    fill = FILL_BILINEAR;
+  }
+  else
+  {
+    fill = FILL_NEAREST;
+  }
+
+  if (p->mode & RM_PHON)
+  {
+    light = LIGHT_PHONG;
+  }
+  else if (p->mode & RM_LAMBERT)
+  {
+    light = LIGHT_LAMBERT;
+  }
+  else
+  {
+    light = LIGHT_NONE;
+  }
+
+  if (p->blend.sorted && !p->frags &&
+      !(p->frags = calloc(p->tiles_x * p->tiles_y, sizeof(pig_fraglist_t))))
+  {
+    p->failed = 1;
+  }
+
+  if (p->blend.sorted && p->frags)
+  {
+    write = WRITE_SORTED;
+  }
+  else if (blend_opaque(p))
+  {
+    write = WRITE_OPAQUE;
+  }
+  else
+  {
+    write = WRITE_BLEND;
+  }
+
+  return (p->samples > 1 ? spans_msaa : spans)[write][fill][light];
+}
+
+/**
+ * Largest pixel coordinate not above a fixed-point coordinate
+ */
+static int
+fixed_floor(pint32_t v)
+{
+  return v >> SUBPIXEL_BITS;
+}
+
+/**
+ * Smallest pixel coordinate not below a fixed-point coordinate
+ */
+static int
+fixed_ceil(pint32_t v)
+{
+  return (v + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS;
+}
+
+/**
+ * Returns non-zero if any pixel in the bounding box of a triangle is covered
+ */
+static int
+covers_pixel(tri_t * t)
+{
+  edge_t * e = t->e;
+  int x, y;
+
+  for (y = t->miny; y <= t->maxy; ++y)
+  {
+    for (x = t->minx; x <= t->maxx; ++x)
+    {
+      if (edge_eval(&e[0], x, y) >= 0 &&
+          edge_eval(&e[1], x, y) >= 0 &&
+          edge_eval(&e[2], x, y) >= 0)
+      {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Triangle setup
+ * Returns zero if the triangle is culled or does not cover any pixels
+ */
+static int
+setup_triangle(pig_t * p, tri_t * t, frag_t * a, frag_t * b, frag_t * c)
+{
+  pint64_t det;
+  edge_t * e = t->e;
+  frag_t * tmp;
+  float x, y;
+  int i, m, front;
+
+  det = (pint64_t)(b->x - a->x) * (c->y - a->y) -
+        (pint64_t)(b->y - a->y) * (c->x - a->x);
+
+  /* The framebuffer is y-up, so counter-clockwise triangles have det > 0 */
+  front = p->front == FRONT_CW ? det < 0 : det > 0;
+  if (det == 0 || (p->cull & (front ? CULL_FRONT : CULL_BACK)))
+  {
+    __sync_fetch_and_add(&p->culled_faces, 1);
+    return 0;
+  }
+
+  /* Edge functions expect counter-clockwise order, flip the others */
+  if (det < 0)
+  {
+    tmp = b;
+    b = c;
+    c = tmp;
+    det = -det;
+  }
+
+  /* Pixels are sampled at integer coordinates, round the box inwards
+   * Samples lie within half a pixel of the centers, so multisampling
+   * widens the box by a pixel. */
+  m = p->samples > 1;
+  t->minx = max(fixed_ceil(min(a->x, min(b->x, c->x))) - m, 0);
+  t->miny = max(fixed_ceil(min(a->y, min(b->y, c->y))) - m, 0);
+  t->maxx = min(fixed_floor(max(a->x, max(b->x, c->x))) + m, p->width - 1);
+  t->maxy = min(fixed_floor(max(a->y, max(b->y, c->y))) + m, p->height - 1);
+  if (t->minx > t->maxx || t->miny > t->maxy)
+  {
+    return 0;
+  }
+
+  /* Edge i is opposite vertex i, so it is the weight of that vertex */
+  setup_edge(&e[0], b, c);
+  setup_edge(&e[1], c, a);
+  setup_edge(&e[2], a, b);
+
+  x = (float)a->x / SUBPIXEL_SCALE;
+  y = (float)a->y / SUBPIXEL_SCALE;
+  /* Depth and 1 / w are linear in screen space, other attributes over w */
+  setup_plane(&t->z, e, det, x, y, a->z, b->z, c->z);
+  setup_plane(&t->w, e, det, x, y, a->w, b->w, c->w);
+  setup_plane(&t->u, e, det, x, y, a->u * a->w, b->u * b->w, c->u * c->w);
+  setup_plane(&t->v, e, det, x, y, a->v * a->w, b->v * b->w, c->v * c->w);
+  setup_plane(&t->r, e, det, x, y, a->r * a->w, b->r * b->w, c->r * c->w);
+  setup_plane(&t->g, e, det, x, y, a->g * a->w, b->g * b->w, c->g * c->w);
+  setup_plane(&t->b, e, det, x, y, a->b * a->w, b->b * b->w, c->b * c->w);
+  setup_plane(&t->a, e, det, x, y, a->a * a->w, b->a * b->w, c->a * c->w);
+  if (p->mode & RM_PHON)
+  {
+    setup_plane(&t->nx, e, det, x, y,
+                a->nx * a->w, b->nx * b->w, c->nx * c->w);
+    setup_plane(&t->ny, e, det, x, y,
+                a->ny * a->w, b->ny * b->w, c->ny * c->w);
+    setup_plane(&t->nz, e, det, x, y,
+                a->nz * a->w, b->nz * b->w, c->nz * c->w);
+  }
+  else if (p->mode & RM_LAMBERT)
+  {
+    setup_plane(&t->l, e, det, x, y, a->l * a->w, b->l * b->w, c->l * c->w);
+  }
+
+  /* Bias the edges so the fill rule becomes a sign test */
+  for (i = 0; i < 3; ++i)
+  {
+    e[i].c -= is_top_left(&e[i]) ? 0 : 1;
+  }
+
+  /* Slivers and sub-pixel triangles often fall between pixel centers */
+  if (!m &&
+      (t->maxx - t->minx + 1) * (t->maxy - t->miny + 1) <= SMALL_TRI_AREA &&
+      !covers_pixel(t))
+  {
+    __sync_fetch_and_add(&p->culled_faces, 1);
+    return 0;
+  }
+
+  t->zmin = min_f(a->z, min_f(b->z, c->z)) - HIZ_EPSILON;
+  return 1;
+}
+
+/**
+ * Farthest depth of a block in a depth plane, only pixels inside the
+ * viewport are considered
+ */
+static float
+plane_zmax(pig_t * p, float * depth, int bx, int by)
+{
+  __m128 zmax;
+  float * dp, z[4];
+  int x, y, x1, y1;
+
+  dp = depth + by * p->stride + bx;
+  if (bx + BLOCK_SIZE <= p->width && by + BLOCK_SIZE <= p->height)
+  {
+    zmax = _mm_load_ps(dp);
+    for (y = 0; y < BLOCK_SIZE; ++y, dp += p->stride)
+    {
+      for (x = 0; x < BLOCK_SIZE; x += 4)
+      {
+        zmax = _mm_max_ps(zmax, _mm_load_ps(dp + x));
+      }
+    }
+
+    _mm_storeu_ps(z, zmax);
+    return max_f(max_f(z[0], z[1]), max_f(z[2], z[3]));
+  }
+
+  x1 = min(BLOCK_SIZE, p->width - bx);
+  y1 = min(BLOCK_SIZE, p->height - by);
+  z[0] = dp[0];
+  for (y = 0; y < y1; ++y, dp += p->stride)
+  {
+    for (x = 0; x < x1; ++x)
+    {
+      z[0] = max_f(z[0], dp[x]);
+    }
+  }
+  return z[0];
+}
+
+/**
+ * Farthest depth of a block, over all samples under multisampling
+ */
+static float
+block_zmax(pig_t * p, int bx, int by)
+{
+  float z;
+  int s;
+
+  if (p->samples == 1)
+  {
+    return plane_zmax(p, p->depth, bx, by);
+  }
+
+  z = plane_zmax(p, p->sample_depth, bx, by);
+  for (s = 1; s < 4; ++s)
+  {
+    z = max_f(z, plane_zmax(p, p->sample_depth +
+                            (size_t)s * p->stride * p->height, bx, by));
+  }
+  return z;
+}
+
+/**
+ * Farthest depth of a tile, computed from the blocks inside the viewport
+ */
+static float
+tile_zmax(pig_t * p, int tx, int ty)
+{
+  float zmax, * zb;
+  int x, y, x1, y1, bpr;
+
+  bpr = p->tiles_x * (TILE_SIZE / BLOCK_SIZE);
+  x1 = min(TILE_SIZE, p->width - tx * TILE_SIZE);
+  y1 = min(TILE_SIZE, p->height - ty * TILE_SIZE);
+  zb = p->hiz_block + (ty * bpr + tx) * (TILE_SIZE / BLOCK_SIZE);
+
+  zmax = zb[0];
+  for (y = 0; y < y1; y += BLOCK_SIZE, zb += bpr)
+  {
+    for (x = 0; x < x1; x += BLOCK_SIZE)
+    {
+      zmax = max_f(zmax, zb[x / BLOCK_SIZE]);
+    }
+  }
+  return zmax;
+}
+
+/**
+ * Rasterizes the part of a triangle inside a single tile
+ * The rectangle is traversed in blocks of BLOCK_SIZE x BLOCK_SIZE pixels,
+ * which are skipped if they lie outside an edge or behind the hierarchical
+ * Z buffer, and filled without any edge tests if they lie inside all three.
+ * The rows of the remaining blocks are handed to the span kernel.
+ */
+static void
+raster_tile(pig_t * p, span_fn span, tri_t * t, int tx, int ty,
+            int minx, int miny, int maxx, int maxy)
+{
+  int bx, by, x0, y0, x1, y1, cx0, cy0, cx1, cy1, y, i, n, m, full, bpr;
+  int drawn;
+  puint32_t tile;
+  float zmin;
+  edge_t * e = t->e;
+  plane_t * z = &t->z;
+
+  /* The whole tile is occluded */
+  tile = ty * p->tiles_x + tx;
+  if (t->zmin > p->hiz_tile[tile])
+  {
+    __sync_fetch_and_add(&p->culled_tiles, 1);
+    return;
+  }
+
+  /* Samples lie within half a pixel of the centers, corners tested under
+   * multisampling are pushed out by a pixel to enclose all of them */
+  m = p->samples > 1;
+  bpr = p->tiles_x * (TILE_SIZE / BLOCK_SIZE);
+  drawn = 0;
+  for (by = miny & ~(BLOCK_SIZE - 1); by <= maxy; by += BLOCK_SIZE)
+  {
+    for (bx = minx & ~(BLOCK_SIZE - 1); bx <= maxx; bx += BLOCK_SIZE)
+    {
+      x0 = max(bx, minx);
+      y0 = max(by, miny);
+      x1 = min(bx + BLOCK_SIZE - 1, maxx);
+      y1 = min(by + BLOCK_SIZE - 1, maxy);
+      cx0 = x0 - m;
+      cy0 = y0 - m;
+      cx1 = x1 + m;
+      cy1 = y1 + m;
+
+      /* Test the corners of the block against all edges */
+      full = 1;
+      for (i = 0; i < 3; ++i)
+      {
+        n = (edge_eval(&e[i], cx0, cy0) >= 0) +
+            (edge_eval(&e[i], cx1, cy0) >= 0) +
+            (edge_eval(&e[i], cx0, cy1) >= 0) +
+            (edge_eval(&e[i], cx1, cy1) >= 0);
+        if (n == 0)
+        {
+          break;
+        }
+        full = full && n == 4;
+      }
+
+      /* Block lies entirely outside one of the edges */
+      if (i != 3)
+      {
+        continue;
+      }
+
+      /* Depth is linear, so its minimum over the block is at a corner */
+      zmin = min_f(min_f(z->dx * cx0 + z->dy * cy0, z->dx * cx1 + z->dy * cy0),
+                   min_f(z->dx * cx0 + z->dy * cy1,
+                         z->dx * cx1 + z->dy * cy1));
+      if (zmin + z->c - HIZ_EPSILON > p->hiz_block[by / BLOCK_SIZE * bpr +
+                                                   bx / BLOCK_SIZE])
+      {
+        continue;
+      }
+
+      /* Carry out a pending fast clear before the tile is first written */
+      if (p->tiles[tile])
+      {
+        pig_raster_resolve(p, tile);
+      }
+
+      for (y = y0; y <= y1; ++y)
+      {
+        span(p, t, x0, x1, y, full);
+      }
+
+      p->hiz_block[by / BLOCK_SIZE * bpr + bx / BLOCK_SIZE] =
+        block_zmax(p, bx, by);
+      drawn = 1;
+    }
+  }
+
+  if (drawn)
+  {
+    p->hiz_tile[tile] = tile_zmax(p, tx, ty);
+  }
+}
+
+/**
+ * Triangle rasterization, restricted to a rectangle of the viewport
+ */
+static void
+raster_triangle(pig_t * p, span_fn span, tri_t * t,
+                int minx, int miny, int maxx, int maxy)
+{
+  int tx, ty;
+
+  minx = max(minx, t->minx);
+  miny = max(miny, t->miny);
+  maxx = min(maxx, t->maxx);
+  maxy = min(maxy, t->maxy);
+
+  for (ty = miny / TILE_SIZE; ty <= maxy / TILE_SIZE; ++ty)
+  {
+    for (tx = minx / TILE_SIZE; tx <= maxx / TILE_SIZE; ++tx)
+    {
+      raster_tile(p, span, t, tx, ty,
+                  max(minx, tx * TILE_SIZE),
+                  max(miny, ty * TILE_SIZE),
+                  min(maxx, tx * TILE_SIZE + TILE_SIZE - 1),
+                  min(maxy, ty * TILE_SIZE + TILE_SIZE - 1));
+    }
+  }
+}
+
+/**
+ * Hierarchical Z test of a whole triangle
+ * Returns zero if the triangle is behind all tiles it overlaps
+ */
+static int
+hiz_visible(pig_t * p, tri_t * t)
+{
+  int tx, ty;
+
+  for (ty = t->miny / TILE_SIZE; ty <= t->maxy / TILE_SIZE; ++ty)
+  {
+    for (tx = t->minx / TILE_SIZE; tx <= t->maxx / TILE_SIZE; ++tx)
+    {
+      if (t->zmin <= p->hiz_tile[ty * p->tiles_x + tx])
+      {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Vertex in clip space
+ */
+typedef struct
+{
+  /* Homogeneous position */
+  vec pos;
+  /* Vertex color and opacity */
+  float r, g, b, a;
+  /* Texture coordinates */
+  float u, v;
+  /* Normal */
+  float nx, ny, nz;
+  /* Light intensity of Lambert shading */
+  float l;
+} clip_t;
+
+/**
+ * Outcodes of a clip-space vertex against the view volume
+ */
+#define CLIP_NEAR   (1 << 0)
+#define CLIP_FAR    (1 << 1)
+#define CLIP_LEFT   (1 << 2)
+#define CLIP_RIGHT  (1 << 3)
+#define CLIP_BOTTOM (1 << 4)
+#define CLIP_TOP    (1 << 5)
+
+/**
+ * Outcodes against the guard band
+ */
+#define CLIP_GB_LEFT   (1 << 6)
+#define CLIP_GB_RIGHT  (1 << 7)
+#define CLIP_GB_BOTTOM (1 << 8)
+#define CLIP_GB_TOP    (1 << 9)
+
+/**
+ * Number of planes polygons are clipped against: near and the guard band
+ */
+#define CLIP_PLANES 5
+
+/**
+ * Upper bound on the vertices of a clipped triangle
+ */
+#define CLIP_VERTS (3 + CLIP_PLANES)
+
+/**
+ * Width of the guard band around the viewport, in pixels
+ * Triangles are only clipped against the sides of the guard band, so most
+ * triangles crossing the edges of the viewport are rasterized unclipped.
+ * Window coordinates of the remaining vertices stay small enough for the
+ * edge functions not to overflow.
+ */
+#define GUARD_BAND 4096
+
+/**
+ * Copies the attributes of a clip-space vertex to a window-space one
+ */
+static void
+copy_attributes(frag_t * f, clip_t * c)
+{
+  f->r = c->r;
+  f->g = c->g;
+  f->b = c->b;
+  f->a = c->a;
+  f->u = c->u;
+  f->v = c->v;
+  f->nx = c->nx;
+  f->ny = c->ny;
+  f->nz = c->nz;
+  f->l = c->l;
+}
+
+/**
+ * Computes the window-space coordinate of a vertex
+ */
+static void
+project_vertex(pig_t * p, frag_t * f, clip_t * c)
+{
+  vec tmp;
+
+  /* Get the normalized device coordinates */
+  tmp.x = c->pos.x / c->pos.w;
+  tmp.y = c->pos.y / c->pos.w;
+  tmp.z = c->pos.z / c->pos.w;
+
+  /* Window coordinates, rounded to the sub-pixel grid */
+  f->x = _mm_cvtss_si32(_mm_set_ss(p->width * (tmp.x + 1.0f) / 2 *
+                                   SUBPIXEL_SCALE));
+  f->y = _mm_cvtss_si32(_mm_set_ss(p->height * (tmp.y + 1.0f) / 2 *
+                                   SUBPIXEL_SCALE));
+  f->z = tmp.z;
+  f->w = 1.0f / c->pos.w;
+
+  copy_attributes(f, c);
+}
+
+/**
+ * Interpolates between two clip-space vertices
+ */
+static void
+lerp_vertex(clip_t * d, clip_t * a, clip_t * b, float t)
+{
+  d->pos.x = a->pos.x + (b->pos.x - a->pos.x) * t;
+  d->pos.y = a->pos.y + (b->pos.y - a->pos.y) * t;
+  d->pos.z = a->pos.z + (b->pos.z - a->pos.z) * t;
+  d->pos.w = a->pos.w + (b->pos.w - a->pos.w) * t;
+  d->r = a->r + (b->r - a->r) * t;
+  d->g = a->g + (b->g - a->g) * t;
+  d->b = a->b + (b->b - a->b) * t;
+  d->a = a->a + (b->a - a->a) * t;
+  d->u = a->u + (b->u - a->u) * t;
+  d->v = a->v + (b->v - a->v) * t;
+  d->nx = a->nx + (b->nx - a->nx) * t;
+  d->ny = a->ny + (b->ny - a->ny) * t;
+  d->nz = a->nz + (b->nz - a->nz) * t;
+  d->l = a->l + (b->l - a->l) * t;
+}
+
+/**
+ * Sutherland-Hodgman clipping of a convex polygon against a plane
+ * The plane keeps points with a non-negative dot product against it.
+ * Returns the number of vertices written to out.
+ */
+static int
+clip_polygon(clip_t * out, clip_t * in, int n, vec * plane)
+{
+  float d0, d1;
+  int i, j, m;
+
+  m = 0;
+  for (i = 0, j = n - 1; i < n; j = i++)
+  {
+    d0 = vec_dot(&in[j].pos, plane);
+    d1 = vec_dot(&in[i].pos, plane);
+
+    if (d0 >= 0.0f)
+    {
+      if (d1 >= 0.0f)
+      {
+        out[m++] = in[i];
+      }
+      else
+      {
+        lerp_vertex(&out[m++], &in[j], &in[i], d0 / (d0 - d1));
+      }
+    }
+    else if (d1 >= 0.0f)
+    {
+      lerp_vertex(&out[m++], &in[i], &in[j], d1 / (d1 - d0));
+      out[m++] = in[i];
+    }
+  }
+
+  return m;
+}
+
+/**
+ * Sets up a projected triangle and runs the hierarchical Z test on it
+ * Returns zero if the triangle is not drawn
+ */
+static int
+accept_triangle(pig_t * p, tri_t * t, frag_t * a, frag_t * b, frag_t * c)
+{
+  if (!setup_triangle(p, t, a, b, c))
+  {
+    return 0;
+  }
+
+  /* Occluded by what was drawn so far, depth only decreases during a draw */
+  if (!hiz_visible(p, t))
+  {
+    __sync_fetch_and_add(&p->culled_tris, 1);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Vertex after the transform stage
+ */
+typedef struct
+{
+  /* Clip-space vertex */
+  clip_t clip;
+  /* Window-space vertex, only valid in front of the near plane */
+  frag_t frag;
+  /* Outcode of the clip-space vertex */
+  puint32_t code;
+} xvert_t;
+
+/**
+ * Mask of the lanes of an outcode which have a bit set
+ */
+static __m128i
+outcode_bit(__m128 mask, int bit)
+{
+  return _mm_and_si128(_mm_castps_si128(mask), _mm_set1_epi32(bit));
+}
+
+/**
+ * Vertex processing stage, handles four vertices per iteration
+ * Positions are gathered into structure-of-arrays form for vec_mul_batch,
+ * then outcodes, the perspective divide, the viewport mapping and Lambert
+ * lighting are all computed in the same pass. Vertices are only projected
+ * if they are in front of the near plane.
+ */
+static void
+transform_vertices(pig_t * p, xvert_t * out, vertex_t * v, puint32_t n)
+{
+  float in[16] __attribute__ ((__aligned__ (16)));
+  float pos[16] __attribute__ ((__aligned__ (16)));
+  float nx[4] __attribute__ ((__aligned__ (16)));
+  float ny[4] __attribute__ ((__aligned__ (16)));
+  float nz[4] __attribute__ ((__aligned__ (16)));
+  float lit[4] __attribute__ ((__aligned__ (16)));
+  float wz[4], ww[4];
+  pint32_t wx[4], wy[4];
+  puint32_t code[4], i, j, k, m;
+  __m128 x, y, z, w, nw, gx, gy, one, two, scale;
+  __m128i c;
+  xvert_t * d;
+  vertex_t * s;
+
+  one = _mm_set1_ps(1.0f);
+  two = _mm_set1_ps(2.0f);
+  scale = _mm_set1_ps(SUBPIXEL_SCALE);
+  gx = _mm_set1_ps(1.0f + 2.0f * GUARD_BAND / p->width);
+  gy = _mm_set1_ps(1.0f + 2.0f * GUARD_BAND / p->height);
+
+  for (i = 0; i < n; i += 4)
+  {
+    /* Gather positions, the last vertex fills up an incomplete group */
+    m = min(4, n - i);
+    for (j = 0; j < 4; ++j)
+    {
+      k = i + min(j, m - 1);
+      in[j + 0] = v[k].x;
+      in[j + 4] = v[k].y;
+      in[j + 8] = v[k].z;
+      in[j + 12] = 1.0f;
+      nx[j] = v[k].nx;
+      ny[j] = v[k].ny;
+      nz[j] = v[k].nz;
+      lit[j] = 1.0f;
+    }
+
+    /* Per-vertex lighting, Phong lights pixels instead */
+    if ((p->mode & RM_LAMBERT) && !(p->mode & RM_PHON))
+    {
+      light_batch(p, lit, nx, ny, nz, 4);
+    }
+
+    vec_mul_batch(pos, in, p->m_mvp, 4);
+    x = _mm_load_ps(pos + 0);
+    z = _mm_load_ps(pos + 8);
+    w = _mm_load_ps(pos + 12);
+
+    /* Moves the band of a banded render onto the viewport */
+    y = _mm_add_ps(_mm_mul_ps(_mm_load_ps(pos + 4),
+                              _mm_set1_ps(p->band_scale)),
+                   _mm_mul_ps(w, _mm_set1_ps(p->band_offset)));
+    _mm_store_ps(pos + 4, y);
+    nw = _mm_sub_ps(_mm_setzero_ps(), w);
+
+    /* Outcodes against the view volume and the guard band */
+    c = outcode_bit(_mm_cmplt_ps(z, nw), CLIP_NEAR);
+    c = _mm_or_si128(c, outcode_bit(_mm_cmpgt_ps(z, w), CLIP_FAR));
+    c = _mm_or_si128(c, outcode_bit(_mm_cmplt_ps(x, nw), CLIP_LEFT));
+    c = _mm_or_si128(c, outcode_bit(_mm_cmpgt_ps(x, w), CLIP_RIGHT));
+    c = _mm_or_si128(c, outcode_bit(_mm_cmplt_ps(y, nw), CLIP_BOTTOM));
+    c = _mm_or_si128(c, outcode_bit(_mm_cmpgt_ps(y, w), CLIP_TOP));
+    c = _mm_or_si128(c, outcode_bit(
+      _mm_cmplt_ps(x, _mm_mul_ps(nw, gx)), CLIP_GB_LEFT));
+    c = _mm_or_si128(c, outcode_bit(
+      _mm_cmpgt_ps(x, _mm_mul_ps(w, gx)), CLIP_GB_RIGHT));
+    c = _mm_or_si128(c, outcode_bit(
+      _mm_cmplt_ps(y, _mm_mul_ps(nw, gy)), CLIP_GB_BOTTOM));
+    c = _mm_or_si128(c, outcode_bit(
+      _mm_cmpgt_ps(y, _mm_mul_ps(w, gy)), CLIP_GB_TOP));
+    _mm_storeu_si128((__m128i*)code, c);
+
+    /* Perspective divide and viewport mapping */
+    x = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(p->width),
+                              _mm_add_ps(_mm_div_ps(x, w), one)), two);
+    y = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(p->height),
+                              _mm_add_ps(_mm_div_ps(y, w), one)), two);
+    _mm_storeu_si128((__m128i*)wx, _mm_cvtps_epi32(_mm_mul_ps(x, scale)));
+    _mm_storeu_si128((__m128i*)wy, _mm_cvtps_epi32(_mm_mul_ps(y, scale)));
+    _mm_storeu_ps(wz, _mm_div_ps(z, w));
+    _mm_storeu_ps(ww, _mm_div_ps(one, w));
+
+    for (j = 0; j < m; ++j)
+    {
+      d = &out[i + j];
+      s = &v[i + j];
+
+      d->clip.pos.x = pos[j + 0];
+      d->clip.pos.y = pos[j + 4];
+      d->clip.pos.z = pos[j + 8];
+      d->clip.pos.w = pos[j + 12];
+      d->clip.r = s->r;
+      d->clip.g = s->g;
+      d->clip.b = s->b;
+      d->clip.a = s->a;
+      d->clip.u = s->u;
+      d->clip.v = s->v;
+      d->clip.nx = s->nx;
+      d->clip.ny = s->ny;
+      d->clip.nz = s->nz;
+      d->clip.l = lit[j];
+      d->code = code[j];
+
+      if (!(d->code & CLIP_NEAR))
+      {
+        d->frag.x = wx[j];
+        d->frag.y = wy[j];
+        d->frag.z = wz[j];
+        d->frag.w = ww[j];
+        copy_attributes(&d->frag, &d->clip);
+      }
+    }
+  }
+}
+
+/**
+ * Clips and sets up a triangle from transformed vertices
+ * Clipping can split the triangle, up to CLIP_VERTS - 2 set up triangles
+ * are written to t. Returns the number of triangles to be drawn.
+ */
+static int
+assemble_triangle(pig_t * p, tri_t * t, xvert_t * a, xvert_t * b,
+                  xvert_t * c)
+{
+  clip_t poly[2][CLIP_VERTS];
+  frag_t f[CLIP_VERTS];
+  puint32_t mask;
+  vec plane[CLIP_PLANES];
+  int i, n, count, cur;
+
+  /* All vertices are outside one of the planes of the view volume */
+  if (a->code & b->code & c->code)
+  {
+    return 0;
+  }
+
+  /* Inside the near plane and the guard band: no clipping needed */
+  mask = a->code | b->code | c->code;
+  if (!(mask & (CLIP_NEAR | CLIP_GB_LEFT | CLIP_GB_RIGHT |
+                CLIP_GB_BOTTOM | CLIP_GB_TOP)))
+  {
+    return accept_triangle(p, t, &a->frag, &b->frag, &c->frag);
+  }
+
+  /* Near plane: z >= -w */
+  plane[0].x = 0.0f; plane[0].y = 0.0f; plane[0].z = 1.0f; plane[0].w = 1.0f;
+
+  /* Guard band: |x| <= gx * w, |y| <= gy * w */
+  plane[1].x = 1.0f; plane[1].y = 0.0f; plane[1].z = 0.0f;
+  plane[1].w = 1.0f + 2.0f * GUARD_BAND / p->width;
+  plane[2].x = -1.0f; plane[2].y = 0.0f; plane[2].z = 0.0f;
+  plane[2].w = plane[1].w;
+  plane[3].x = 0.0f; plane[3].y = 1.0f; plane[3].z = 0.0f;
+  plane[3].w = 1.0f + 2.0f * GUARD_BAND / p->height;
+  plane[4].x = 0.0f; plane[4].y = -1.0f; plane[4].z = 0.0f;
+  plane[4].w = plane[3].w;
+
+  /* Only clip against the planes some vertex lies outside of */
+  n = 3;
+  cur = 0;
+  poly[0][0] = a->clip;
+  poly[0][1] = b->clip;
+  poly[0][2] = c->clip;
+  for (i = 0; i < CLIP_PLANES && n >= 3; ++i)
+  {
+    if (mask & (i == 0 ? CLIP_NEAR : (CLIP_GB_LEFT << (i - 1))))
+    {
+      n = clip_polygon(poly[cur ^ 1], poly[cur], n, &plane[i]);
+      cur ^= 1;
+    }
+  }
+
+  /* Project the polygon and split it into a fan of triangles */
+  for (i = 0; i < n; ++i)
+  {
+    project_vertex(p, &f[i], &poly[cur][i]);
+  }
+
+  count = 0;
+  for (i = 2; i < n; ++i)
+  {
+    count += accept_triangle(p, &t[count], &f[0], &f[i - 1], &f[i]);
+  }
+
+  return count;
+}
+
+/**
+ * Transforms, clips and sets up a triangle
+ * Returns the number of set up triangles written to t
+ */
+static int
+prepare_triangle(pig_t * p, tri_t * t, vertex_t * a, vertex_t * b,
+                 vertex_t * c)
+{
+  xvert_t x[3];
+  vertex_t v[3];
+
+  v[0] = *a;
+  v[1] = *b;
+  v[2] = *c;
+  transform_vertices(p, x, v, 3);
+
+  return assemble_triangle(p, t, &x[0], &x[1], &x[2]);
+}
+
+int
+pig_raster_triangle(pig_t * p, vertex_t * a, vertex_t * b, vertex_t * c)
+{
+  tri_t t[CLIP_VERTS - 2];
+  span_fn span;
+  int i, n;
+
+  p->failed = 0;
+  span = select_span(p);
+  n = prepare_triangle(p, t, a, b, c);
+  for (i = 0; i < n; ++i)
+  {
+    raster_triangle(p, span, &t[i],
+                    t[i].minx, t[i].miny, t[i].maxx, t[i].maxy);
+  }
+  return !p->failed;
+}
+
+/**
+ * Triangles set up by a front end task
+ */
+typedef struct
+{
+  tri_t * tris;
+  puint32_t count;
+  puint32_t size;
+} batch_t;
+
+/**
+ * Binned draw call, shared by the front end and the tile workers
+ */
+typedef struct
+{
+  pig_t * p;
+  /* Input triangles, either 3 * count vertices or transformed vertices
+   * referenced by 3 * count indices */
+  vertex_t * v;
+  xvert_t * xv;
+  puint32_t * idx;
+  puint32_t nverts;
+  puint32_t count;
+  /* Pipeline of the draw call */
+  span_fn span;
+  /* Set up triangles of each front end task */
+  batch_t * batches;
+  puint32_t nbatches;
+  /* Triangles binned into tile i are bins[start[i]] .. bins[start[i + 1]] */
+  puint32_t * start;
+  tri_t ** bins;
+} bin_t;
+
+/**
+ * Front end: transforms, clips and sets up a batch of triangles
+ */
+static void
+bin_setup(void * arg, puint32_t idx)
+{
+  bin_t * b = (bin_t*)arg;
+  batch_t * batch = &b->batches[idx];
+  puint32_t i, j, end, * k;
+  tri_t * tris;
+  xvert_t xv[VERTEX_BATCH];
+
+  end = min((idx + 1) * SETUP_BATCH, b->count);
+  for (i = idx * SETUP_BATCH; i < end; ++i)
+  {
+    /* Transform the next few triangles of a non-indexed draw */
+    if (!b->idx && (i - idx * SETUP_BATCH) % (VERTEX_BATCH / 3) == 0)
+    {
+      transform_vertices(b->p, xv, b->v + i * 3,
+                         min(VERTEX_BATCH / 3, end - i) * 3);
+    }
+
+    /* Make room for the worst case of clipping */
+    if (batch->count + CLIP_VERTS - 2 > batch->size)
+    {
+      tris = (tri_t*)realloc(batch->tris, sizeof(tri_t) * batch->size * 2);
+      if (!tris)
+      {
+        b->p->failed = 1;
+        return;
+      }
+      batch->tris = tris;
+      batch->size *= 2;
+    }
+
+    if (b->idx)
+    {
+      k = b->idx + i * 3;
+      if (k[0] < b->nverts && k[1] < b->nverts && k[2] < b->nverts)
+      {
+        batch->count += assemble_triangle(b->p, batch->tris + batch->count,
+                                          &b->xv[k[0]], &b->xv[k[1]],
+                                          &b->xv[k[2]]);
+      }
+    }
+    else
+    {
+      j = (i - idx * SETUP_BATCH) % (VERTEX_BATCH / 3) * 3;
+      batch->count += assemble_triangle(b->p, batch->tris + batch->count,
+                                        &xv[j], &xv[j + 1], &xv[j + 2]);
+    }
+  }
+}
+
+/**
+ * Back end: rasterizes the triangles of a tile in submission order
+ */
+static void
+bin_raster(void * arg, puint32_t tile)
+{
+  bin_t * b = (bin_t*)arg;
+  int x0, y0, x1, y1;
+  puint32_t i;
+
+  x0 = (tile % b->p->tiles_x) * TILE_SIZE;
+  y0 = (tile / b->p->tiles_x) * TILE_SIZE;
+  x1 = x0 + TILE_SIZE - 1;
+  y1 = y0 + TILE_SIZE - 1;
+
+  for (i = b->start[tile]; i < b->start[tile + 1]; ++i)
+  {
+    raster_triangle(b->p, b->span, b->bins[i], x0, y0, x1, y1);
+  }
+}
+
+/**
+ * Spawns the workers or resizes the pool if the thread count changed
+ * A pool which could not start all of its workers is kept as it is.
+ */
+static void
+update_pool(pig_t * p)
+{
+  if (pool_requested(p->pool) != p->threads)
+  {
+    pool_free(p->pool);
+    p->pool = pool_create(p->threads);
+  }
+}
+
+pool_t *
+pig_raster_pool(pig_t * p)
+{
+  update_pool(p);
+  return p->threads > 1 ? p->pool : NULL;
+}
+
+/**
+ * Bins and draws the triangles described by b
+ */
+static void
+bin_draw(bin_t * b)
+{
+  pig_t * p = b->p;
+  tri_t * t;
+  puint32_t i, j, x, y, tiles, total, count;
+
+  count = b->count;
+  b->nbatches = (count + SETUP_BATCH - 1) / SETUP_BATCH;
+  tiles = p->tiles_x * p->tiles_y;
+  b->batches = (batch_t*)calloc(b->nbatches, sizeof(batch_t));
+  b->start = (puint32_t*)calloc(tiles + 1, sizeof(puint32_t));
+  b->bins = NULL;
+  if (!b->batches || !b->start)
+  {
+    p->failed = 1;
+    goto cleanup;
+  }
+
+  for (i = 0; i < b->nbatches; ++i)
+  {
+    b->batches[i].size = SETUP_BATCH;
+    b->batches[i].tris = (tri_t*)malloc(sizeof(tri_t) * SETUP_BATCH);
+    if (!b->batches[i].tris)
+    {
+      p->failed = 1;
+      goto cleanup;
+    }
+  }
+
+  /* Transform and set up all triangles */
+  pool_run(p->pool, bin_setup, b, b->nbatches);
+
+  /* Count the triangles overlapping each tile */
+  for (i = 0; i < b->nbatches; ++i)
+  {
+    for (j = 0; j < b->batches[i].count; ++j)
+    {
+      t = &b->batches[i].tris[j];
+      for (y = t->miny / TILE_SIZE; y <= (puint32_t)t->maxy / TILE_SIZE; ++y)
+      {
+        for (x = t->minx / TILE_SIZE; x <= (puint32_t)t->maxx / TILE_SIZE; ++x)
+        {
+          b->start[y * p->tiles_x + x + 1]++;
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < tiles; ++i)
+  {
+    b->start[i + 1] += b->start[i];
+  }
+
+  if (!(total = b->start[tiles]))
+  {
+    goto cleanup;
+  }
+
+  if (!(b->bins = (tri_t**)malloc(sizeof(tri_t*) * total)))
+  {
+    p->failed = 1;
+    goto cleanup;
+  }
+
+  /* Fill in the bins, start[i] is moved to the end of bin i */
+  for (i = 0; i < b->nbatches; ++i)
+  {
+    for (j = 0; j < b->batches[i].count; ++j)
+    {
+      t = &b->batches[i].tris[j];
+      for (y = t->miny / TILE_SIZE; y <= (puint32_t)t->maxy / TILE_SIZE; ++y)
+      {
+        for (x = t->minx / TILE_SIZE; x <= (puint32_t)t->maxx / TILE_SIZE; ++x)
+        {
+          b->bins[b->start[y * p->tiles_x + x]++] = t;
+        }
+      }
+    }
+  }
+
+  for (i = tiles; i > 0; --i)
+  {
+    b->start[i] = b->start[i - 1];
+  }
+  b->start[0] = 0;
+
+  /* Tiles are disjoint, so workers never touch the same pixels */
+  pool_run(p->pool, bin_raster, b, tiles);
+
+cleanup:
+  if (b->batches)
+  {
+    for (i = 0; i < b->nbatches; ++i)
+    {
+      free(b->batches[i].tris);
+    }
+  }
+  free(b->batches);
+  free(b->bins);
+  free(b->start);
+}
+
+int
+pig_raster_triangles(pig_t * p, vertex_t * v, puint32_t count)
+{
+  tri_t t[CLIP_VERTS - 2];
+  xvert_t xv[VERTEX_BATCH];
+  puint32_t i, k;
+  bin_t b;
+  span_fn span;
+  int j, n;
+
+  p->failed = 0;
+  update_pool(p);
+  span = select_span(p);
+
+  if (p->threads > 1)
+  {
+    b.p = p;
+    b.span = span;
+    b.v = v;
+    b.xv = NULL;
+    b.idx = NULL;
+    b.nverts = 0;
+    b.count = count;
+    bin_draw(&b);
+    return !p->failed;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    /* Vertices go through the transform stage a few triangles at a time */
+    k = i % (VERTEX_BATCH / 3) * 3;
+    if (k == 0)
+    {
+      transform_vertices(p, xv, v + i * 3,
+                         min(VERTEX_BATCH / 3, count - i) * 3);
+    }
+
+    n = assemble_triangle(p, t, &xv[k], &xv[k + 1], &xv[k + 2]);
+    for (j = 0; j < n; ++j)
+    {
+      raster_triangle(p, span, &t[j],
+                      t[j].minx, t[j].miny, t[j].maxx, t[j].maxy);
+    }
+  }
+  return !p->failed;
+}
+
+/**
+ * Transforms a range of vertices into the post-transform buffer
+ */
+static void
+transform_batch(void * arg, puint32_t idx)
+{
+  bin_t * b = (bin_t*)arg;
+  puint32_t first;
+
+  first = idx * SETUP_BATCH;
+  transform_vertices(b->p, b->xv + first, b->v + first,
+                     min(SETUP_BATCH, b->nverts - first));
+}
+
+/**
+ * Grows the post-transform buffer to hold nverts vertices
+ * The buffer is kept around for the next draw call. Returns NULL if it
+ * cannot be allocated.
+ */
+static xvert_t *
+reserve_xverts(pig_t * p, puint32_t nverts)
+{
+  xvert_t * xv;
+
+  if (p->xverts_size < nverts)
+  {
+    if (!(xv = (xvert_t*)realloc(p->xverts, sizeof(xvert_t) * nverts)))
+    {
+      return NULL;
+    }
+    p->xverts = xv;
+    p->xverts_size = nverts;
+  }
+
+  return (xvert_t*)p->xverts;
+}
+
+int
+pig_raster_indexed(pig_t * p, vertex_t * v, puint32_t nverts,
+                   puint32_t * idx, puint32_t count)
+{
+  tri_t t[CLIP_VERTS - 2];
+  xvert_t * xv;
+  puint32_t i, * k;
+  bin_t b;
+  span_fn span;
+  int j, n;
+
+  p->failed = 0;
+  if (!nverts || !count)
+  {
+    return 1;
+  }
+  update_pool(p);
+  span = select_span(p);
+  if (!(xv = reserve_xverts(p, nverts)))
+  {
+    p->failed = 1;
+    return 0;
+  }
+
+  b.p = p;
+  b.span = span;
+  b.v = v;
+  b.xv = xv;
+  b.idx = idx;
+  b.nverts = nverts;
+  b.count = count;
+
+  /* Every vertex is transformed exactly once */
+  pool_run(p->threads > 1 ? p->pool : NULL, transform_batch, &b,
+           (nverts + SETUP_BATCH - 1) / SETUP_BATCH);
+
+  if (p->threads > 1)
+  {
+    bin_draw(&b);
+    return !p->failed;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    k = idx + i * 3;
+    if (k[0] >= nverts || k[1] >= nverts || k[2] >= nverts)
+    {
+      continue;
+    }
+
+    n = assemble_triangle(p, t, &b.xv[k[0]], &b.xv[k[1]], &b.xv[k[2]]);
+    for (j = 0; j < n; ++j)
+    {
+      raster_triangle(p, span, &t[j],
+                      t[j].minx, t[j].miny, t[j].maxx, t[j].maxy);
+    }
+  }
+  return !p->failed;
+}
+
+/**
+ * Line set up for rasterization
+ */
+typedef struct
+{
+  /* Color of the line, packed as in the framebuffer */
+  puint32_t color;
+  /* Non-zero if pixels are depth tested and write their depth */
+  int depth;
+  /* Non-zero if pixels are blended with the framebuffer */
+  int blend;
+} line_t;
+
+/**
+ * Packs the color of a line from its first vertex, lines have no surface
+ * to texture or light per pixel, so they only take the Lambert term
+ */
+static puint32_t
+line_color(clip_t * c)
+{
+  float l = min_f(max_f(c->l, 0.0f), 1.0f);
+
+  return (puint32_t)(min_f(max_f(c->r, 0.0f), 1.0f) * l * 255.0f) |
+         (puint32_t)(min_f(max_f(c->g, 0.0f), 1.0f) * l * 255.0f) << 8 |
+         (puint32_t)(min_f(max_f(c->b, 0.0f), 1.0f) * l * 255.0f) << 16 |
+         (puint32_t)(min_f(max_f(c->a, 0.0f), 1.0f) * 255.0f) << 24;
+}
+
+/**
+ * Writes a single pixel of a line, testing the depth of each sample
+ */
+static void
+line_pixel(pig_t * p, line_t * l, int x, int y, float z)
+{
+  puint32_t src[4], dst[4], * cp, tile;
+  float * dp;
+  size_t offset, plane;
+  int s, n, keep;
+
+  tile = (y / TILE_SIZE) * p->tiles_x + x / TILE_SIZE;
+  if (p->tiles[tile])
+  {
+    pig_raster_resolve(p, tile);
+  }
+
+  offset = (size_t)y * p->stride + x;
+  plane = (size_t)p->stride * p->height;
+  n = p->samples;
+  cp = n > 1 ? p->sample_color + offset : p->color + offset;
+  dp = n > 1 ? p->sample_depth + offset : p->depth + offset;
+
+  keep = 0;
+  for (s = 0; s < n; ++s)
+  {
+    if (!l->depth || z <= dp[s * plane])
+    {
+      keep |= 1 << s;
+    }
+  }
+  if (!keep)
+  {
+    return;
+  }
+
+  /* Samples fill the lanes of blend_pixels, as in pig_composite */
+  memset(dst, 0, sizeof(dst));
+  for (s = 0; s < n; ++s)
+  {
+    dst[s] = n > 1 && p->sample_full[offset] ? cp[0] : cp[s * plane];
+  }
+  for (s = 0; s < 4; ++s)
+  {
+    src[s] = l->color;
+  }
+  if (l->blend)
+  {
+    blend_pixels(p, src, dst, 4);
+  }
+
+  for (s = 0; s < n; ++s)
+  {
+    if (!(keep & (1 << s)))
+    {
+      continue;
+    }
+    dst[s] = l->blend ? src[s] : (dst[s] & ~0x00FFFFFF) |
+                                 (l->color & 0x00FFFFFF);
+    if (l->depth)
+    {
+      dp[s * plane] = z;
+    }
+  }
+
+  cp[0] = dst[0];
+  if (n > 1)
+  {
+    p->sample_full[offset] = dst[0] == dst[1] && dst[0] == dst[2] &&
+                             dst[0] == dst[3] ? 0xFF : 0;
+    for (s = 1; s < 4 && !p->sample_full[offset]; ++s)
+    {
+      cp[s * plane] = dst[s];
+    }
+  }
+}
+
+/**
+ * Writes pixels [x0, x1] of row y of a line, z is the depth of x0
+ * Without multisampling, groups of four pixels are tested and written at
+ * once like in the span kernels.
+ */
+static void
+line_run(pig_t * p, line_t * l, int x0, int x1, int y, float z, float dz)
+{
+  __m128i lane, xs, m, c, old;
+  __m128 zs, depth, keep;
+  puint32_t src[4], * cp, tile;
+  float * dp;
+  int x;
+
+  if (p->samples > 1)
+  {
+    for (x = x0; x <= x1; ++x)
+    {
+      line_pixel(p, l, x, y, z + dz * (x - x0));
+    }
+    return;
+  }
+
+  for (x = x0 / TILE_SIZE; x <= x1 / TILE_SIZE; ++x)
+  {
+    tile = (y / TILE_SIZE) * p->tiles_x + x;
+    if (p->tiles[tile])
+    {
+      pig_raster_resolve(p, tile);
+    }
+  }
+
+  lane = _mm_set_epi32(3, 2, 1, 0);
+  for (x = x0 & ~3; x <= x1; x += 4)
+  {
+    /* Lanes inside the run which pass the depth test */
+    xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+    m = _mm_andnot_si128(
+      _mm_or_si128(_mm_cmplt_epi32(xs, _mm_set1_epi32(x0)),
+                   _mm_cmpgt_epi32(xs, _mm_set1_epi32(x1))),
+      _mm_set1_epi32(-1)
+    );
+    cp = p->color + y * p->stride + x;
+    dp = p->depth + y * p->stride + x;
+    zs = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(dz), _mm_cvtepi32_ps(
+      _mm_sub_epi32(xs, _mm_set1_epi32(x0)))));
+    depth = _mm_load_ps(dp);
+    keep = _mm_castsi128_ps(m);
+    if (l->depth)
+    {
+      keep = _mm_and_ps(keep, _mm_cmpge_ps(depth, zs));
+    }
+    if (!_mm_movemask_ps(keep))
+    {
+      continue;
+    }
+
+    old = _mm_load_si128((__m128i*)cp);
+    if (l->blend)
+    {
+      _mm_storeu_si128((__m128i*)src, _mm_set1_epi32(l->color));
+      blend_pixels(p, src, cp, 4);
+      c = _mm_loadu_si128((__m128i*)src);
+    }
+    else
+    {
+      c = _mm_or_si128(_mm_and_si128(old, _mm_set1_epi32(~0x00FFFFFF)),
+                       _mm_set1_epi32(l->color & 0x00FFFFFF));
+    }
+
+    m = _mm_castps_si128(keep);
+    _mm_store_si128((__m128i*)cp, _mm_or_si128(_mm_and_si128(m, c),
+                                               _mm_andnot_si128(m, old)));
+    if (l->depth)
+    {
+      _mm_store_ps(dp, _mm_or_ps(_mm_and_ps(keep, zs),
+                                 _mm_andnot_ps(keep, depth)));
+    }
+  }
+}
+
+/**
+ * Writes pixels [y0, y1] of column x of a line, z is the depth of y0
+ * Without multisampling, the pixels are tested and blended four rows at a
+ * time, walking the planes by their stride.
+ */
+static void
+line_column(pig_t * p, line_t * l, int x, int y0, int y1, float z, float dz)
+{
+  puint32_t src[4], dst[4], * cp[4], tile;
+  float * dp[4], zs[4];
+  int y, i, n, keep;
+
+  if (p->samples > 1)
+  {
+    for (y = y0; y <= y1; ++y)
+    {
+      line_pixel(p, l, x, y, z + dz * (y - y0));
+    }
+    return;
+  }
+
+  for (y = y0 / TILE_SIZE; y <= y1 / TILE_SIZE; ++y)
+  {
+    tile = y * p->tiles_x + x / TILE_SIZE;
+    if (p->tiles[tile])
+    {
+      pig_raster_resolve(p, tile);
+    }
+  }
+
+  memset(dst, 0, sizeof(dst));
+  for (y = y0; y <= y1; y += 4)
+  {
+    /* Rows of the group which pass the depth test */
+    n = min(4, y1 - y + 1);
+    keep = 0;
+    for (i = 0; i < n; ++i)
+    {
+      cp[i] = p->color + (size_t)(y + i) * p->stride + x;
+      dp[i] = p->depth + (size_t)(y + i) * p->stride + x;
+      zs[i] = z + dz * (y + i - y0);
+      dst[i] = *cp[i];
+      if (!l->depth || zs[i] <= *dp[i])
+      {
+        keep |= 1 << i;
+      }
+    }
+    if (!keep)
+    {
+      continue;
+    }
+
+    if (l->blend)
+    {
+      for (i = 0; i < 4; ++i)
+      {
+        src[i] = l->color;
+      }
+      blend_pixels(p, src, dst, 4);
+    }
+    for (i = 0; i < n; ++i)
+    {
+      if (!(keep & (1 << i)))
+      {
+        continue;
+      }
+      *cp[i] = l->blend ? src[i] : (dst[i] & ~0x00FFFFFF) |
+                                   (l->color & 0x00FFFFFF);
+      if (l->depth)
+      {
+        *dp[i] = zs[i];
+      }
+    }
+  }
+}
+
+/**
+ * Run-slice line rasterization
+ * The pixels of a line form one run along its major axis per step along
+ * its minor axis. Run j holds the steps k with k * minor / major rounding
+ * to j, its end is tracked by an exact integer DDA, so runs are written in
+ * one go instead of pixel by pixel. Horizontal runs go through line_run,
+ * vertical ones through line_column.
+ */
+static void
+emit_line(pig_t * p, line_t * l, frag_t * a, frag_t * b)
+{
+  int x0, y0, x1, y1, sx, sy, major, minor, start, end, d, q, r, j;
+  int xa, xb, ya, yb, x, y;
+  float dz, za, dza;
+
+  /* Endpoints are rounded to the nearest pixel, they are only clipped to the
+   * guard band, so the pixels of a line do not depend on the viewport */
+  x0 = (a->x + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+  y0 = (a->y + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+  x1 = (b->x + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+  y1 = (b->y + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+
+  sx = x1 < x0 ? -1 : 1;
+  sy = y1 < y0 ? -1 : 1;
+  major = max(abs(x1 - x0), abs(y1 - y0));
+  minor = min(abs(x1 - x0), abs(y1 - y0));
+  dz = major ? (b->z - a->z) / major : 0.0f;
+
+  /* Run j ends at the first k with k * 2 * minor >= (2 * j + 1) * major,
+   * which is q + (r != 0) for q and r the quotient and remainder */
+  d = 2 * max(minor, 1);
+  q = major / d;
+  r = major % d;
+  for (j = 0, start = 0; j <= minor; ++j, start = end)
+  {
+    end = j == minor ? major + 1 : q + (r != 0);
+    q += 2 * major / d;
+    r += 2 * major % d;
+    if (r >= d)
+    {
+      ++q;
+      r -= d;
+    }
+
+    if (abs(x1 - x0) >= abs(y1 - y0))
+    {
+      /* Runs are written left to right, cut to the viewport */
+      y = y0 + sy * j;
+      xa = sx > 0 ? x0 + start : x0 - end + 1;
+      xb = sx > 0 ? x0 + end - 1 : x0 - start;
+      za = a->z + dz * (sx > 0 ? start : end - 1);
+      dza = sx > 0 ? dz : -dz;
+      if (xa < 0)
+      {
+        za += dza * -xa;
+        xa = 0;
+      }
+      xb = min(xb, p->width - 1);
+      if (y >= 0 && y < p->height && xa <= xb)
+      {
+        line_run(p, l, xa, xb, y, za, dza);
+      }
+      continue;
+    }
+
+    /* Runs are written bottom to top, cut to the viewport */
+    x = x0 + sx * j;
+    ya = sy > 0 ? y0 + start : y0 - end + 1;
+    yb = sy > 0 ? y0 + end - 1 : y0 - start;
+    za = a->z + dz * (sy > 0 ? start : end - 1);
+    dza = sy > 0 ? dz : -dz;
+    if (ya < 0)
+    {
+      za += dza * -ya;
+      ya = 0;
+    }
+    yb = min(yb, p->height - 1);
+    if (x >= 0 && x < p->width && ya <= yb)
+    {
+      line_column(p, l, x, ya, yb, za, dza);
+    }
+  }
+}
+
+/**
+ * Signed distances of a clip-space position to the planes bounding lines,
+ * the sides of the guard band and 0 <= z <= w, the depth range kept by the
+ * span kernels
+ */
+static void
+line_distances(pig_t * p, float * d, vec * v)
+{
+  float gx, gy;
+
+  gx = 1.0f + 2.0f * GUARD_BAND / p->width;
+  gy = 1.0f + 2.0f * GUARD_BAND / p->height;
+  d[0] = gx * v->w + v->x;
+  d[1] = gx * v->w - v->x;
+  d[2] = gy * v->w + v->y;
+  d[3] = gy * v->w - v->y;
+  d[4] = v->z;
+  d[5] = v->w - v->z;
+}
+
+/**
+ * Clips a line between two transformed vertices and rasterizes it
+ * Lines are clipped to the guard band, pixels outside the viewport are
+ * dropped while rasterizing.
+ */
+static void
+draw_line(pig_t * p, line_t * l, xvert_t * a, xvert_t * b)
+{
+  clip_t c;
+  frag_t f[2];
+  float d0[6], d1[6], t0, t1;
+  int i;
+
+  if (a->code & b->code & (CLIP_NEAR | CLIP_FAR | CLIP_LEFT | CLIP_RIGHT |
+                           CLIP_BOTTOM | CLIP_TOP))
+  {
+    return;
+  }
+
+  /* Parametric clipping shrinks the range [t0, t1] of the line */
+  line_distances(p, d0, &a->clip.pos);
+  line_distances(p, d1, &b->clip.pos);
+  t0 = 0.0f;
+  t1 = 1.0f;
+  for (i = 0; i < 6; ++i)
+  {
+    if (d0[i] < 0.0f && d1[i] < 0.0f)
+    {
+      return;
+    }
+    if (d0[i] < 0.0f)
+    {
+      t0 = max_f(t0, d0[i] / (d0[i] - d1[i]));
+    }
+    else if (d1[i] < 0.0f)
+    {
+      t1 = min_f(t1, d0[i] / (d0[i] - d1[i]));
+    }
+  }
+  if (t0 > t1)
+  {
+    return;
+  }
+
+  /* Endpoints inside the guard band were already projected */
+  f[0] = a->frag;
+  f[1] = b->frag;
+  if (t0 > 0.0f)
+  {
+    lerp_vertex(&c, &a->clip, &b->clip, t0);
+    if (c.pos.w <= 0.0f)
+    {
+      return;
+    }
+    project_vertex(p, &f[0], &c);
+  }
+  if (t1 < 1.0f)
+  {
+    lerp_vertex(&c, &a->clip, &b->clip, t1);
+    if (c.pos.w <= 0.0f)
+    {
+      return;
+    }
+    project_vertex(p, &f[1], &c);
+  }
+
+  l->color = line_color(&a->clip);
+  emit_line(p, l, &f[0], &f[1]);
+}
+
+/**
+ * Sets up the state shared by the lines of a draw call
+ * Sorted draws have no fragment lists for lines, which are blended in
+ * submission order instead.
+ */
+static void
+setup_lines(pig_t * p, line_t * l)
+{
+  l->color = 0;
+  l->depth = p->line_depth != 0;
+  l->blend = !blend_opaque(p);
+}
+
+int
+pig_raster_lines(pig_t * p, vertex_t * v, puint32_t count)
+{
+  xvert_t xv[VERTEX_BATCH];
+  line_t l;
+  puint32_t i, j, n;
+
+  p->failed = 0;
+  setup_lines(p, &l);
+  for (i = 0; i < count; i += VERTEX_BATCH / 2)
+  {
+    n = min(VERTEX_BATCH / 2, count - i);
+    transform_vertices(p, xv, v + i * 2, n * 2);
+    for (j = 0; j < n; ++j)
+    {
+      draw_line(p, &l, &xv[j * 2], &xv[j * 2 + 1]);
+    }
+  }
+  return 1;
+}
+
+int
+pig_raster_wireframe(pig_t * p, vertex_t * v, puint32_t nverts,
+                     puint32_t * idx, puint32_t count)
+{
+  xvert_t * xv;
+  line_t l;
+  puint32_t i, * k;
+
+  p->failed = 0;
+  if (!nverts || !count)
+  {
+    return 1;
+  }
+  if (!(xv = reserve_xverts(p, nverts)))
+  {
+    p->failed = 1;
+    return 0;
+  }
+
+  /* Every vertex is transformed once, edges shared by two triangles are
+   * drawn twice, which only shows with blending */
+  setup_lines(p, &l);
+  transform_vertices(p, xv, v, nverts);
+  for (i = 0; i < count; ++i)
+  {
+    k = idx + i * 3;
+    if (k[0] >= nverts || k[1] >= nverts || k[2] >= nverts)
+    {
+      continue;
+    }
+
+    draw_line(p, &l, &xv[k[0]], &xv[k[1]]);
+    draw_line(p, &l, &xv[k[1]], &xv[k[2]]);
+    draw_line(p, &l, &xv[k[2]], &xv[k[0]]);
+  }
+  return 1;
+}
+
+void
+pig_raster_init(void)
+{
+  __builtin_cpu_init();
+  spans = __builtin_cpu_supports("avx2") ? spans_avx2 : spans_sse2;
+}
+
+/**
+ * Fills pixels [x0, x1] of a color row, x1 - x0 + 1 is a multiple of 16
+ */
+static void
+clear_color_row(puint32_t * cp, int x0, int x1, __m128i c)
+{
+  int x;
+
+  for (x = x0; x <= x1; x += 16)
+  {
+    _mm_store_si128((__m128i*)(cp + x + 0), c);
+    _mm_store_si128((__m128i*)(cp + x + 4), c);
+    _mm_store_si128((__m128i*)(cp + x + 8), c);
+    _mm_store_si128((__m128i*)(cp + x + 12), c);
+  }
+}
+
+/**
+ * Fills pixels [x0, x1] of a depth row, x1 - x0 + 1 is a multiple of 16
+ */
+static void
+clear_depth_row(float * dp, int x0, int x1, __m128 d)
+{
+  int x;
+
+  for (x = x0; x <= x1; x += 16)
+  {
+    _mm_store_ps(dp + x + 0, d);
+    _mm_store_ps(dp + x + 4, d);
+    _mm_store_ps(dp + x + 8, d);
+    _mm_store_ps(dp + x + 12, d);
+  }
+}
+
+void
+pig_raster_clear(pig_t * p, puint32_t flags, puint32_t color, float depth,
+                 int x0, int y0, int x1, int y1)
+{
+  __m128i c;
+  __m128 d;
+  size_t row, plane;
+  int y, s, ms;
+
+  c = _mm_set1_epi32(color);
+  d = _mm_set1_ps(depth);
+  plane = (size_t)p->stride * p->height;
+  ms = p->samples > 1;
+
+  /* Rows are 64-byte aligned, so whole cache lines are written at once */
+  for (y = y0; y <= y1; ++y)
+  {
+    row = (size_t)y * p->stride;
+    if (flags & CLEAR_COLOR)
+    {
+      clear_color_row(p->color + row, x0, x1, c);
+
+      /* Flagged pixels only read the first sample plane */
+      if (ms)
+      {
+        clear_color_row(p->sample_color + row, x0, x1, c);
+        memset(p->sample_full + row + x0, 0xFF, x1 - x0 + 1);
+      }
+    }
+
+    if (flags & CLEAR_DEPTH)
+    {
+      clear_depth_row(p->depth + row, x0, x1, d);
+      for (s = 0; ms && s < 4; ++s)
+      {
+        clear_depth_row(p->sample_depth + s * plane + row, x0, x1, d);
+      }
+    }
+  }
+}
+
+void
+pig_raster_resolve(pig_t * p, puint32_t tile)
+{
+  int x0, y0;
+
+  x0 = (tile % p->tiles_x) * TILE_SIZE;
+  y0 = (tile / p->tiles_x) * TILE_SIZE;
+  pig_raster_clear(p, p->tiles[tile], p->clear_color, p->clear_depth,
+                   x0, y0, min(x0 + TILE_SIZE, p->stride) - 1,
+                   min(y0 + TILE_SIZE, p->height) - 1);
+  p->tiles[tile] = 0;
+}
+
+/**
+ * Blends n sorted fragments into the pixel at offset in the color plane
+ * Fragments behind the final depth of the pixel are dropped.
+ */
+static void
+composite_pixel(pig_t * p, pig_frag_t * f, puint32_t n, size_t offset)
+{
+  puint32_t color[4], dst[4], i;
+
+  memset(color, 0, sizeof(color));
+  memset(dst, 0, sizeof(dst));
+  dst[0] = p->color[offset];
+  for (i = 0; i < n; ++i)
+  {
+    /* Geometry drawn after the fragment may have covered it */
+    if (f[i].z > p->depth[offset])
+    {
+      continue;
+    }
+    color[0] = f[i].color;
+    blend_pixels(p, color, dst, 4);
+    dst[0] = color[0];
+  }
+  p->color[offset] = dst[0];
+}
+
+/**
+ * Blends n sorted fragments into the samples of the pixel at offset
+ * The four samples fill the lanes of blend_pixels, each fragment is then
+ * only kept in the samples it covers and is not behind.
+ */
+static void
+composite_samples(pig_t * p, pig_frag_t * f, puint32_t n, size_t offset)
+{
+  puint32_t color[4], dst[4], * cp, i, s, keep;
+  size_t plane;
+
+  plane = (size_t)p->stride * p->height;
+  cp = p->sample_color + offset;
+  for (s = 0; s < 4; ++s)
+  {
+    dst[s] = p->sample_full[offset] ? cp[0] : cp[s * plane];
+  }
+
+  for (i = 0; i < n; ++i)
+  {
+    /* Covered samples the fragment is still in front of */
+    keep = 0;
+    for (s = 0; s < 4; ++s)
+    {
+      if ((f[i].samples & (1 << s)) &&
+          f[i].z <= p->sample_depth[offset + s * plane])
+      {
+        keep |= 1 << s;
+      }
+      color[s] = f[i].color;
+    }
+    if (!keep)
+    {
+      continue;
+    }
+    blend_pixels(p, color, dst, 4);
+    for (s = 0; s < 4; ++s)
+    {
+      dst[s] = keep & (1 << s) ? color[s] : dst[s];
+    }
+  }
+
+  cp[0] = dst[0];
+  p->sample_full[offset] = dst[0] == dst[1] && dst[0] == dst[2] &&
+                           dst[0] == dst[3] ? 0xFF : 0;
+  for (s = 1; s < 4 && !p->sample_full[offset]; ++s)
+  {
+    cp[s * plane] = dst[s];
+  }
+}
+
+/**
+ * Blends the fragment list of a tile into the color plane
+ * Fragments are bucketed by pixel with a counting sort, which keeps them in
+ * submission order, then the few fragments of each pixel are sorted back to
+ * front by insertion and blended one after the other.
+ */
+static void
+composite_tile(void * arg, puint32_t tile)
+{
+  pig_t * p = (pig_t*)arg;
+  pig_fraglist_t * l = (pig_fraglist_t*)p->frags + tile;
+  pig_frag_t * sorted, f;
+  puint32_t * start, i, j, k, m, x0, y0;
+  size_t offset;
+
+  if (!l->count)
   {
-    emit_triangle(p, f + 0, f + 1, f + 2);
     return;
   }
+
+  start = (puint32_t*)calloc(TILE_SIZE * TILE_SIZE + 1, sizeof(puint32_t));
+  sorted = (pig_frag_t*)malloc(sizeof(pig_frag_t) * l->count);
+  if (!start || !sorted)
+  {
+    p->failed = 1;
+    goto cleanup;
+  }
+
+  /* Bucket i ends up as sorted[start[i - 1]] .. sorted[start[i]] */
+  for (i = 0; i < l->count; ++i)
+  {
+    start[l->frags[i].pixel + 1]++;
+  }
+  for (i = 0; i < TILE_SIZE * TILE_SIZE; ++i)
+  {
+    start[i + 1] += start[i];
+  }
+  for (i = 0; i < l->count; ++i)
+  {
+    sorted[start[l->frags[i].pixel]++] = l->frags[i];
+  }
+
+  if (p->tiles[tile])
+  {
+    pig_raster_resolve(p, tile);
+  }
+
+  x0 = (tile % p->tiles_x) * TILE_SIZE;
+  y0 = (tile / p->tiles_x) * TILE_SIZE;
+  for (i = 0, j = 0; i < TILE_SIZE * TILE_SIZE; j = start[i++])
+  {
+    if (j == start[i])
+    {
+      continue;
+    }
+
+    /* Farther fragments go first, ties keep their submission order */
+    for (k = j + 1; k < start[i]; ++k)
+    {
+      f = sorted[k];
+      for (m = k; m > j && sorted[m - 1].z < f.z; --m)
+      {
+        sorted[m] = sorted[m - 1];
+      }
+      sorted[m] = f;
+    }
+
+    offset = (size_t)(y0 + i / TILE_SIZE) * p->stride + x0 + i % TILE_SIZE;
+    if (p->samples > 1)
+    {
+      composite_samples(p, sorted + j, start[i] - j, offset);
+    }
+    else
+    {
+      composite_pixel(p, sorted + j, start[i] - j, offset);
+    }
+  }
+
+cleanup:
+  l->count = 0;
+  free(start);
+  free(sorted);
+}
+
+/**
+ * Averages the samples of a tile into the color plane and copies the depth
+ * of the first sample, tiles with a pending clear keep it
+ */
+static void
+downsample_tile(void * arg, puint32_t tile)
+{
+  pig_t * p = (pig_t*)arg;
+  __m128i c0, c1, c2, c3, comp;
+  puint32_t * cp, flags;
+  size_t plane, offset;
+  int x, y, x0, y0, x1, y1;
+
+  x0 = (tile % p->tiles_x) * TILE_SIZE;
+  y0 = (tile / p->tiles_x) * TILE_SIZE;
+  x1 = min(x0 + TILE_SIZE, (int)p->stride);
+  y1 = min(y0 + TILE_SIZE, (int)p->height);
+  plane = (size_t)p->stride * p->height;
+
+  for (y = y0; y < y1; ++y)
+  {
+    offset = (size_t)y * p->stride;
+    if (!(p->tiles[tile] & CLEAR_DEPTH))
+    {
+      memcpy(p->depth + offset + x0, p->sample_depth + offset + x0,
+             (x1 - x0) * sizeof(float));
+    }
+    if (p->tiles[tile] & CLEAR_COLOR)
+    {
+      continue;
+    }
+
+    for (x = x0; x < x1; x += 4)
+    {
+      cp = p->sample_color + offset + x;
+      c0 = _mm_load_si128((__m128i*)cp);
+      memcpy(&flags, p->sample_full + offset + x, sizeof(flags));
+      if (flags != 0xFFFFFFFF)
+      {
+        /* Pairwise rounded averages, flagged pixels keep the first sample */
+        c1 = _mm_load_si128((__m128i*)(cp + plane));
+        c2 = _mm_load_si128((__m128i*)(cp + 2 * plane));
+        c3 = _mm_load_si128((__m128i*)(cp + 3 * plane));
+        comp = _mm_cvtsi32_si128(flags);
+        comp = _mm_unpacklo_epi16(_mm_unpacklo_epi8(comp, comp),
+                                  _mm_unpacklo_epi8(comp, comp));
+        c1 = _mm_avg_epu8(_mm_avg_epu8(c0, c1), _mm_avg_epu8(c2, c3));
+        c0 = _mm_or_si128(_mm_and_si128(comp, c0),
+                          _mm_andnot_si128(comp, c1));
+      }
+      _mm_store_si128((__m128i*)(p->color + offset + x), c0);
+    }
+  }
+}
+
+void
+pig_raster_downsample(pig_t * p)
+{
+  update_pool(p);
+  pool_run(p->threads > 1 ? p->pool : NULL, downsample_tile, p,
+           p->tiles_x * p->tiles_y);
+}
+
+int
+pig_raster_composite(pig_t * p)
+{
+  p->failed = 0;
+  if (!p->frags)
+  {
+    return 1;
+  }
+
+  update_pool(p);
+  pool_run(p->threads > 1 ? p->pool : NULL, composite_tile, p,
+           p->tiles_x * p->tiles_y);
+  return !p->failed;
 }
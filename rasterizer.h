@@ -25,7 +25,48 @@ THE SOFTWARE.
 #define __PIG_RASTERIZER_H__
 
 #include "pig.h"
+#include "pool.h"
 
-void pig_raster_triangle(pig_t *, vertex_t *, vertex_t *, vertex_t *);
+/* Size of the blocks tested for trivial accept / reject */
+#define BLOCK_SIZE 8
+
+/* Size of the screen tiles used by binning and fast clears */
+#define TILE_SIZE 64
+
+/* Fragment of a sorted draw, waiting in the list of its tile */
+typedef struct
+{
+  /* Shaded color, blended by pig_composite */
+  puint32_t color;
+  /* Depth */
+  float z;
+  /* Pixel in the tile, y * TILE_SIZE + x */
+  puint16_t pixel;
+  /* Covered samples under multisampling */
+  puint8_t samples;
+} pig_frag_t;
+
+/* Fragments of a tile in submission order */
+typedef struct
+{
+  pig_frag_t * frags;
+  puint32_t count;
+  puint32_t size;
+} pig_fraglist_t;
+
+void pig_raster_init(void);
+int pig_raster_triangle(pig_t *, vertex_t *, vertex_t *, vertex_t *);
+int pig_raster_triangles(pig_t *, vertex_t *, puint32_t);
+int pig_raster_indexed(pig_t *, vertex_t *, puint32_t, puint32_t *,
+                       puint32_t);
+int pig_raster_lines(pig_t *, vertex_t *, puint32_t);
+int pig_raster_wireframe(pig_t *, vertex_t *, puint32_t, puint32_t *,
+                         puint32_t);
+void pig_raster_clear(pig_t *, puint32_t, puint32_t, float,
+                      int, int, int, int);
+void pig_raster_resolve(pig_t *, puint32_t);
+int pig_raster_composite(pig_t *);
+pool_t * pig_raster_pool(pig_t *);
+void pig_raster_downsample(pig_t *);
 
 #endif /*__PIG_RASTERIZER_H__*/
@@ -0,0 +1,493 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+/*
+ * Span kernel template
+ * Included by pipeline.h once per pipeline, with SPAN_NAME, SPAN_FILL,
+ * SPAN_LIGHT and SPAN_WRITE defined. Defines SPAN_NAME_sse2, SPAN_NAME_avx2
+ * and the multisampled SPAN_NAME_msaa, whose fill, lighting and write stages
+ * are fixed at compile time. There is no include guard.
+ */
+
+#if SPAN_FILL == FILL_COLOR
+#define SPAN_SHADE_FILL(p, t, g) fill_color(t, g)
+#elif SPAN_FILL == FILL_NEAREST
+#define SPAN_SHADE_FILL(p, t, g) fill_nearest(p, t, g)
+#else
+#define SPAN_SHADE_FILL(p, t, g) fill_bilinear(p, t, g)
+#endif
+
+#if SPAN_LIGHT == LIGHT_LAMBERT
+#define SPAN_SHADE_LIGHT(p, t, g) light_lambert(t, g)
+#elif SPAN_LIGHT == LIGHT_PHONG
+#define SPAN_SHADE_LIGHT(p, t, g) light_phong(p, t, g)
+#else
+#define SPAN_SHADE_LIGHT(p, t, g)
+#endif
+
+/**
+ * 4-wide SSE2 span kernel
+ * Pixels of a group are tested and written together using a lane mask. Rows
+ * of the framebuffer are padded, so groups never cross the end of a row.
+ */
+static void
+SPAN_CAT(SPAN_NAME, _sse2)(pig_t * p, tri_t * t, int x0, int x1, int y,
+                           int full)
+{
+  __m128i lane, xs, cover, w0, w1, w2, d0, d1, d2;
+  __m128 z, dz, zrow, dw, wrow, xf, rw, depth, keep;
+#if SPAN_FILL != FILL_COLOR
+  __m128 du, urow, dv, vrow;
+#endif
+#if SPAN_WRITE != WRITE_SORTED
+  __m128i c, m, old;
+  puint32_t * cp;
+#endif
+  float * dp;
+  group_t g;
+  int x;
+
+  lane = _mm_set_epi32(3, 2, 1, 0);
+  d0 = _mm_set_epi32(3 * t->e[0].a, 2 * t->e[0].a, t->e[0].a, 0);
+  d1 = _mm_set_epi32(3 * t->e[1].a, 2 * t->e[1].a, t->e[1].a, 0);
+  d2 = _mm_set_epi32(3 * t->e[2].a, 2 * t->e[2].a, t->e[2].a, 0);
+  dz = _mm_set1_ps(t->z.dx);
+  zrow = _mm_set1_ps(t->z.dy * y + t->z.c);
+  dw = _mm_set1_ps(t->w.dx);
+  wrow = _mm_set1_ps(t->w.dy * y + t->w.c);
+#if SPAN_FILL != FILL_COLOR
+  du = _mm_set1_ps(t->u.dx);
+  urow = _mm_set1_ps(t->u.dy * y + t->u.c);
+  dv = _mm_set1_ps(t->v.dx);
+  vrow = _mm_set1_ps(t->v.dy * y + t->v.c);
+#endif
+  g.y = y;
+  g.n = 4;
+#if SPAN_WRITE == WRITE_SORTED
+  memset(g.samples, 1, sizeof(g.samples));
+#endif
+
+  for (x = x0 & ~3; x <= x1; x += 4)
+  {
+    /* Lanes inside the span */
+    xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+    cover = _mm_andnot_si128(
+      _mm_or_si128(_mm_cmplt_epi32(xs, _mm_set1_epi32(x0)),
+                   _mm_cmpgt_epi32(xs, _mm_set1_epi32(x1))),
+      _mm_set1_epi32(-1)
+    );
+
+    /* Lanes inside the triangle */
+    if (!full)
+    {
+      w0 = _mm_add_epi32(d0, _mm_set1_epi32(
+        edge_clamp(&t->e[0], x, y)));
+      w1 = _mm_add_epi32(d1, _mm_set1_epi32(
+        edge_clamp(&t->e[1], x, y)));
+      w2 = _mm_add_epi32(d2, _mm_set1_epi32(
+        edge_clamp(&t->e[2], x, y)));
+      cover = _mm_and_si128(cover, _mm_cmpgt_epi32(
+        _mm_or_si128(w0, _mm_or_si128(w1, w2)),
+        _mm_set1_epi32(-1)
+      ));
+    }
+
+    /* Depth range and depth test */
+    dp = p->depth + y * p->stride + x;
+    z = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(xs), dz), zrow);
+    depth = _mm_load_ps(dp);
+    keep = _mm_and_ps(_mm_cmpge_ps(z, _mm_setzero_ps()),
+                      _mm_cmple_ps(z, _mm_set1_ps(1.0f)));
+    keep = _mm_and_ps(keep, _mm_cmpge_ps(depth, z));
+    keep = _mm_and_ps(keep, _mm_castsi128_ps(cover));
+    if (!(g.mask = _mm_movemask_ps(keep)))
+    {
+      continue;
+    }
+
+    /* A single reciprocal of 1 / w gives the perspective-correct values */
+    g.x = x;
+    xf = _mm_cvtepi32_ps(xs);
+    rw = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(xf, dw), wrow));
+    _mm_storeu_ps(g.w, rw);
+#if SPAN_FILL != FILL_COLOR
+    _mm_storeu_ps(g.u, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xf, du), urow), rw));
+    _mm_storeu_ps(g.v, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xf, dv), vrow), rw));
+#endif
+    SPAN_SHADE_FILL(p, t, &g);
+    SPAN_SHADE_LIGHT(p, t, &g);
+
+#if SPAN_WRITE == WRITE_SORTED
+    /* Fragments wait in the list of their tile, the planes are left alone */
+    _mm_storeu_ps(g.z, z);
+    append_fragments(p, &g);
+#else
+    cp = p->color + y * p->stride + x;
+    old = _mm_load_si128((__m128i*)cp);
+#if SPAN_WRITE == WRITE_BLEND
+    blend_pixels(p, g.color, cp, 4);
+    c = _mm_loadu_si128((__m128i*)g.color);
+#else
+    /* Keep the alpha of the framebuffer */
+    c = _mm_or_si128(_mm_and_si128(old, _mm_set1_epi32(~0x00FFFFFF)),
+                     _mm_and_si128(_mm_loadu_si128((__m128i*)g.color),
+                                   _mm_set1_epi32(0x00FFFFFF)));
+#endif
+
+    /* Write the covered pixels */
+    m = _mm_castps_si128(keep);
+    c = _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, old));
+    _mm_store_si128((__m128i*)cp, c);
+    _mm_store_ps(dp, _mm_or_ps(_mm_and_ps(keep, z),
+                               _mm_andnot_ps(keep, depth)));
+#endif
+  }
+}
+
+/**
+ * 8-wide AVX2 span kernel
+ * The stages are plain SSE functions, they are only entered once per group
+ * to keep switches between AVX and SSE state rare.
+ */
+static __attribute__ ((__target__ ("avx2"))) void
+SPAN_CAT(SPAN_NAME, _avx2)(pig_t * p, tri_t * t, int x0, int x1, int y,
+                           int full)
+{
+  __m256i lane, xs, cover, w0, w1, w2, d0, d1, d2;
+  __m256 z, dz, zrow, dw, wrow, xf, rw, depth, keep;
+#if SPAN_FILL != FILL_COLOR
+  __m256 du, urow, dv, vrow;
+#endif
+#if SPAN_WRITE != WRITE_SORTED
+  __m256i c, old;
+  puint32_t * cp;
+#endif
+  float * dp;
+  group_t g;
+  int x;
+
+  lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  d0 = _mm256_mullo_epi32(lane, _mm256_set1_epi32(t->e[0].a));
+  d1 = _mm256_mullo_epi32(lane, _mm256_set1_epi32(t->e[1].a));
+  d2 = _mm256_mullo_epi32(lane, _mm256_set1_epi32(t->e[2].a));
+  dz = _mm256_set1_ps(t->z.dx);
+  zrow = _mm256_set1_ps(t->z.dy * y + t->z.c);
+  dw = _mm256_set1_ps(t->w.dx);
+  wrow = _mm256_set1_ps(t->w.dy * y + t->w.c);
+#if SPAN_FILL != FILL_COLOR
+  du = _mm256_set1_ps(t->u.dx);
+  urow = _mm256_set1_ps(t->u.dy * y + t->u.c);
+  dv = _mm256_set1_ps(t->v.dx);
+  vrow = _mm256_set1_ps(t->v.dy * y + t->v.c);
+#endif
+  g.y = y;
+  g.n = 8;
+#if SPAN_WRITE == WRITE_SORTED
+  memset(g.samples, 1, sizeof(g.samples));
+#endif
+
+  for (x = x0 & ~7; x <= x1; x += 8)
+  {
+    /* Lanes inside the span */
+    xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+    cover = _mm256_andnot_si256(
+      _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(x0), xs),
+                      _mm256_cmpgt_epi32(xs, _mm256_set1_epi32(x1))),
+      _mm256_set1_epi32(-1)
+    );
+
+    /* Lanes inside the triangle */
+    if (!full)
+    {
+      w0 = _mm256_add_epi32(d0, _mm256_set1_epi32(
+        edge_clamp(&t->e[0], x, y)));
+      w1 = _mm256_add_epi32(d1, _mm256_set1_epi32(
+        edge_clamp(&t->e[1], x, y)));
+      w2 = _mm256_add_epi32(d2, _mm256_set1_epi32(
+        edge_clamp(&t->e[2], x, y)));
+      cover = _mm256_and_si256(cover, _mm256_cmpgt_epi32(
+        _mm256_or_si256(w0, _mm256_or_si256(w1, w2)),
+        _mm256_set1_epi32(-1)
+      ));
+    }
+
+    /* Depth range and depth test */
+    dp = p->depth + y * p->stride + x;
+    z = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(xs), dz), zrow);
+    depth = _mm256_load_ps(dp);
+    keep = _mm256_and_ps(_mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_GE_OQ),
+                         _mm256_cmp_ps(z, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(depth, z, _CMP_GE_OQ));
+    keep = _mm256_and_ps(keep, _mm256_castsi256_ps(cover));
+    if (!(g.mask = _mm256_movemask_ps(keep)))
+    {
+      continue;
+    }
+
+    /* Shade the surviving fragments */
+    g.x = x;
+    xf = _mm256_cvtepi32_ps(xs);
+    rw = _mm256_div_ps(_mm256_set1_ps(1.0f),
+                       _mm256_add_ps(_mm256_mul_ps(xf, dw), wrow));
+    _mm256_storeu_ps(g.w, rw);
+#if SPAN_FILL != FILL_COLOR
+    _mm256_storeu_ps(g.u, _mm256_mul_ps(
+      _mm256_add_ps(_mm256_mul_ps(xf, du), urow), rw));
+    _mm256_storeu_ps(g.v, _mm256_mul_ps(
+      _mm256_add_ps(_mm256_mul_ps(xf, dv), vrow), rw));
+#endif
+    SPAN_SHADE_FILL(p, t, &g);
+    SPAN_SHADE_LIGHT(p, t, &g);
+
+#if SPAN_WRITE == WRITE_SORTED
+    /* Fragments wait in the list of their tile, the planes are left alone */
+    _mm256_storeu_ps(g.z, z);
+    append_fragments(p, &g);
+#else
+    cp = p->color + y * p->stride + x;
+    old = _mm256_load_si256((__m256i*)cp);
+#if SPAN_WRITE == WRITE_BLEND
+    blend_pixels(p, g.color, cp, 8);
+    c = _mm256_loadu_si256((__m256i*)g.color);
+#else
+    /* Keep the alpha of the framebuffer */
+    c = _mm256_or_si256(_mm256_and_si256(old, _mm256_set1_epi32(~0x00FFFFFF)),
+                        _mm256_and_si256(
+                          _mm256_loadu_si256((__m256i*)g.color),
+                          _mm256_set1_epi32(0x00FFFFFF)));
+#endif
+
+    /* Write the covered pixels */
+    c = _mm256_blendv_epi8(old, c, _mm256_castps_si256(keep));
+    _mm256_store_si256((__m256i*)cp, c);
+    _mm256_store_ps(dp, _mm256_blendv_ps(depth, z, keep));
+#endif
+  }
+}
+
+/**
+ * 4-wide SSE2 span kernel of 4x multisampling
+ * Coverage and depth are tested at each sample, while the pixel is shaded
+ * once at its center. Pixels whose samples share a color are flagged in
+ * sample_full, the other sample planes are only read and written for groups
+ * holding an unflagged pixel.
+ */
+static void
+SPAN_CAT(SPAN_NAME, _msaa)(pig_t * p, tri_t * t, int x0, int x1, int y,
+                           int full)
+{
+  __m128i lane, xs, inside, cover, any, w0, w1, w2, d0, d1, d2;
+  __m128 zc, dz, zrow, dw, wrow, xf, rw, z[4], depth[4], keep[4];
+#if SPAN_FILL != FILL_COLOR
+  __m128 du, urow, dv, vrow;
+#endif
+#if SPAN_WRITE == WRITE_SORTED
+  int bits[4], i;
+#else
+  __m128i c[4], old[4], comp, m;
+  puint32_t * cp, flags;
+#if SPAN_WRITE == WRITE_BLEND
+  __m128i mix;
+  puint32_t src[4], dst[4];
+#endif
+#endif
+  int eo[3][4], x, s;
+  float zo[4];
+  size_t plane, offset;
+  group_t g;
+
+  lane = _mm_set_epi32(3, 2, 1, 0);
+  d0 = _mm_set_epi32(3 * t->e[0].a, 2 * t->e[0].a, t->e[0].a, 0);
+  d1 = _mm_set_epi32(3 * t->e[1].a, 2 * t->e[1].a, t->e[1].a, 0);
+  d2 = _mm_set_epi32(3 * t->e[2].a, 2 * t->e[2].a, t->e[2].a, 0);
+  dz = _mm_set1_ps(t->z.dx);
+  zrow = _mm_set1_ps(t->z.dy * y + t->z.c);
+  dw = _mm_set1_ps(t->w.dx);
+  wrow = _mm_set1_ps(t->w.dy * y + t->w.c);
+#if SPAN_FILL != FILL_COLOR
+  du = _mm_set1_ps(t->u.dx);
+  urow = _mm_set1_ps(t->u.dy * y + t->u.c);
+  dv = _mm_set1_ps(t->v.dx);
+  vrow = _mm_set1_ps(t->v.dy * y + t->v.c);
+#endif
+  g.y = y;
+  g.n = 4;
+
+  /* Offsets of the samples from the centers, exact for the edge functions */
+  for (s = 0; s < 4; ++s)
+  {
+    eo[0][s] = (t->e[0].a * sample_x[s] + t->e[0].b * sample_y[s]) /
+               SUBPIXEL_SCALE;
+    eo[1][s] = (t->e[1].a * sample_x[s] + t->e[1].b * sample_y[s]) /
+               SUBPIXEL_SCALE;
+    eo[2][s] = (t->e[2].a * sample_x[s] + t->e[2].b * sample_y[s]) /
+               SUBPIXEL_SCALE;
+    zo[s] = (t->z.dx * sample_x[s] + t->z.dy * sample_y[s]) / SUBPIXEL_SCALE;
+  }
+  plane = (size_t)p->stride * p->height;
+
+  for (x = x0 & ~3; x <= x1; x += 4)
+  {
+    /* Lanes inside the span */
+    xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+    inside = _mm_andnot_si128(
+      _mm_or_si128(_mm_cmplt_epi32(xs, _mm_set1_epi32(x0)),
+                   _mm_cmpgt_epi32(xs, _mm_set1_epi32(x1))),
+      _mm_set1_epi32(-1)
+    );
+
+    /* Samples inside the triangle which pass the depth test */
+    offset = (size_t)y * p->stride + x;
+    zc = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(xs), dz), zrow);
+    any = _mm_setzero_si128();
+    for (s = 0; s < 4; ++s)
+    {
+      cover = inside;
+      if (!full)
+      {
+        w0 = _mm_add_epi32(d0, _mm_set1_epi32(
+          edge_clamp(&t->e[0], x, y) + eo[0][s]));
+        w1 = _mm_add_epi32(d1, _mm_set1_epi32(
+          edge_clamp(&t->e[1], x, y) + eo[1][s]));
+        w2 = _mm_add_epi32(d2, _mm_set1_epi32(
+          edge_clamp(&t->e[2], x, y) + eo[2][s]));
+        cover = _mm_and_si128(cover, _mm_cmpgt_epi32(
+          _mm_or_si128(w0, _mm_or_si128(w1, w2)),
+          _mm_set1_epi32(-1)
+        ));
+      }
+
+      z[s] = _mm_add_ps(zc, _mm_set1_ps(zo[s]));
+      depth[s] = _mm_load_ps(p->sample_depth + s * plane + offset);
+      keep[s] = _mm_and_ps(_mm_cmpge_ps(z[s], _mm_setzero_ps()),
+                           _mm_cmple_ps(z[s], _mm_set1_ps(1.0f)));
+      keep[s] = _mm_and_ps(keep[s], _mm_cmpge_ps(depth[s], z[s]));
+      keep[s] = _mm_and_ps(keep[s], _mm_castsi128_ps(cover));
+      any = _mm_or_si128(any, _mm_castps_si128(keep[s]));
+    }
+    if (!(g.mask = _mm_movemask_ps(_mm_castsi128_ps(any))))
+    {
+      continue;
+    }
+
+    /* Shade once per pixel, at its center */
+    g.x = x;
+    xf = _mm_cvtepi32_ps(xs);
+    rw = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(xf, dw), wrow));
+    _mm_storeu_ps(g.w, rw);
+#if SPAN_FILL != FILL_COLOR
+    _mm_storeu_ps(g.u, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xf, du), urow), rw));
+    _mm_storeu_ps(g.v, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xf, dv), vrow), rw));
+#endif
+    SPAN_SHADE_FILL(p, t, &g);
+    SPAN_SHADE_LIGHT(p, t, &g);
+
+#if SPAN_WRITE == WRITE_SORTED
+    /* Fragments carry their covered samples, the planes are left alone */
+    _mm_storeu_ps(g.z, zc);
+    for (s = 0; s < 4; ++s)
+    {
+      bits[s] = _mm_movemask_ps(keep[s]);
+    }
+    for (i = 0; i < 4; ++i)
+    {
+      g.samples[i] = ((bits[0] >> i) & 1) | (((bits[1] >> i) & 1) << 1) |
+                     (((bits[2] >> i) & 1) << 2) | (((bits[3] >> i) & 1) << 3);
+    }
+    append_fragments(p, &g);
+#else
+    /* Flags of the pixels widened to lanes, flagged lanes reuse plane 0 */
+    memcpy(&flags, p->sample_full + offset, sizeof(flags));
+    comp = _mm_cvtsi32_si128(flags);
+    comp = _mm_unpacklo_epi16(_mm_unpacklo_epi8(comp, comp),
+                              _mm_unpacklo_epi8(comp, comp));
+    cp = p->sample_color + offset;
+    old[0] = _mm_load_si128((__m128i*)cp);
+    for (s = 1; s < 4; ++s)
+    {
+      old[s] = old[0];
+      if (flags != 0xFFFFFFFF)
+      {
+        old[s] = _mm_or_si128(
+          _mm_and_si128(comp, old[0]),
+          _mm_andnot_si128(comp, _mm_load_si128((__m128i*)(cp + s * plane))));
+      }
+    }
+
+    for (s = 0; s < 4; ++s)
+    {
+#if SPAN_WRITE == WRITE_BLEND
+      /* Samples of flagged groups share the destination, blend once */
+      if (s == 0 || flags != 0xFFFFFFFF)
+      {
+        memcpy(src, g.color, sizeof(src));
+        _mm_storeu_si128((__m128i*)dst, old[s]);
+        blend_pixels(p, src, dst, 4);
+        mix = _mm_loadu_si128((__m128i*)src);
+      }
+      c[s] = mix;
+#else
+      /* Keep the alpha of the framebuffer */
+      c[s] = _mm_or_si128(
+        _mm_and_si128(old[s], _mm_set1_epi32(~0x00FFFFFF)),
+        _mm_and_si128(_mm_loadu_si128((__m128i*)g.color),
+                      _mm_set1_epi32(0x00FFFFFF)));
+#endif
+      m = _mm_castps_si128(keep[s]);
+      c[s] = _mm_or_si128(_mm_and_si128(m, c[s]), _mm_andnot_si128(m, old[s]));
+    }
+
+    /* Pixels are flagged again whenever their samples end up equal */
+    comp = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi32(c[1], c[0]),
+                                       _mm_cmpeq_epi32(c[2], c[0])),
+                         _mm_cmpeq_epi32(c[3], c[0]));
+    _mm_store_si128((__m128i*)cp, c[0]);
+    if (_mm_movemask_epi8(comp) != 0xFFFF)
+    {
+      for (s = 1; s < 4; ++s)
+      {
+        _mm_store_si128((__m128i*)(cp + s * plane), c[s]);
+      }
+    }
+    comp = _mm_packs_epi32(comp, comp);
+    flags = _mm_cvtsi128_si32(_mm_packs_epi16(comp, comp));
+    memcpy(p->sample_full + offset, &flags, sizeof(flags));
+
+    for (s = 0; s < 4; ++s)
+    {
+      if (_mm_movemask_ps(keep[s]))
+      {
+        _mm_store_ps(p->sample_depth + s * plane + offset,
+                     _mm_or_ps(_mm_and_ps(keep[s], z[s]),
+                               _mm_andnot_ps(keep[s], depth[s])));
+      }
+    }
+#endif
+  }
+}
+
+#undef SPAN_SHADE_LIGHT
+#undef SPAN_SHADE_FILL
+#undef SPAN_LIGHT
+#undef SPAN_FILL
+#undef SPAN_NAME
@@ -0,0 +1,266 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+/*
+ * Banded rendering test
+ * Renders an image several bands tall into a PNG and into raw RGB rows,
+ * decodes the PNG and checks that both hold the same pixels, and that the
+ * bands match the image rendered in one pass.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "pig.h"
+
+/* Size of the image and of the bands it is rendered in */
+#define WIDTH 512
+#define HEIGHT 1000
+#define BAND 64
+#define TRIS 300
+
+/* Largest IDAT chunk written by the encoder */
+#define IDAT_SIZE (256 * 1024)
+
+/* Growing buffer receiving encoded bytes */
+typedef struct
+{
+  puint8_t * data;
+  size_t size;
+  size_t cap;
+} buffer_t;
+
+static int
+buffer_sink(void * user, const void * data, size_t size)
+{
+  buffer_t * b = (buffer_t*)user;
+  puint8_t * d;
+
+  if (b->size + size > b->cap)
+  {
+    b->cap = (b->size + size) * 2;
+    if (!(d = (puint8_t*)realloc(b->data, b->cap)))
+    {
+      return 0;
+    }
+    b->data = d;
+  }
+  memcpy(b->data + b->size, data, size);
+  b->size += size;
+  return 1;
+}
+
+/**
+ * Draws the same random triangles into every band
+ */
+static void
+draw_scene(pig_t * p, void * user)
+{
+  vertex_t v[TRIS * 3];
+  puint32_t seed, i;
+
+  (void)user;
+  seed = 1;
+  memset(v, 0, sizeof(v));
+  for (i = 0; i < TRIS * 3; ++i)
+  {
+    seed = seed * 1103515245u + 12345u;
+    v[i].x = ((seed >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+    seed = seed * 1103515245u + 12345u;
+    v[i].y = ((seed >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+    seed = seed * 1103515245u + 12345u;
+    v[i].z = ((seed >> 8) & 0xFFFF) / 65535.0f;
+    v[i].r = (i % 7) / 6.0f;
+    v[i].g = (i % 5) / 4.0f;
+    v[i].b = (i % 3) / 2.0f;
+    v[i].a = 1.0f;
+  }
+
+  mat_identity(p->m_mvp);
+  p->cull = CULL_NONE;
+  pig_clear(p, CLEAR_COLOR | CLEAR_DEPTH | CLEAR_FAST, 0xFF402010, 1.0f);
+  pig_triangle(p, v, TRIS);
+}
+
+static puint32_t
+get_u32(const puint8_t * d)
+{
+  return (puint32_t)d[0] << 24 | (puint32_t)d[1] << 16 |
+         (puint32_t)d[2] << 8 | d[3];
+}
+
+static int
+paeth(int a, int b, int c)
+{
+  int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+
+  return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+/**
+ * Decodes an 8-bit RGB PNG into rgb, checking the chunk CRCs and sizes
+ */
+static int
+decode_png(buffer_t * png, puint8_t * rgb)
+{
+  static const puint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  puint8_t * raw, * row, * prev;
+  size_t pos, n, stride;
+  puint32_t len, y, i, a, b, c;
+  z_stream z;
+  int ok, ret;
+
+  stride = WIDTH * 3 + 1;
+  if (png->size < 8 || memcmp(png->data, signature, 8) ||
+      !(raw = (puint8_t*)malloc(stride * HEIGHT)))
+  {
+    return 0;
+  }
+
+  memset(&z, 0, sizeof(z));
+  inflateInit(&z);
+  z.next_out = raw;
+  z.avail_out = stride * HEIGHT;
+  ok = 1;
+  ret = Z_OK;
+  for (pos = 8; ok && pos + 12 <= png->size; pos += 12 + len)
+  {
+    len = get_u32(png->data + pos);
+    if (pos + 12 + len > png->size ||
+        crc32(crc32(0L, Z_NULL, 0), png->data + pos + 4, len + 4) !=
+        get_u32(png->data + pos + 8 + len))
+    {
+      ok = 0;
+    }
+    else if (!memcmp(png->data + pos + 4, "IHDR", 4))
+    {
+      ok = get_u32(png->data + pos + 8) == WIDTH &&
+           get_u32(png->data + pos + 12) == HEIGHT;
+    }
+    else if (!memcmp(png->data + pos + 4, "IDAT", 4))
+    {
+      ok = len <= IDAT_SIZE;
+      z.next_in = png->data + pos + 8;
+      z.avail_in = len;
+      ret = inflate(&z, Z_NO_FLUSH);
+      ok = ok && (ret == Z_OK || ret == Z_STREAM_END);
+    }
+  }
+  inflateEnd(&z);
+  ok = ok && ret == Z_STREAM_END && z.avail_out == 0;
+
+  /* Undo the row filters */
+  n = WIDTH * 3;
+  for (y = 0; ok && y < HEIGHT; ++y)
+  {
+    row = raw + y * stride;
+    prev = y ? rgb + (y - 1) * n : NULL;
+    for (i = 0; i < n; ++i)
+    {
+      a = i >= 3 ? rgb[y * n + i - 3] : 0;
+      b = prev ? prev[i] : 0;
+      c = prev && i >= 3 ? prev[i - 3] : 0;
+      switch (row[0])
+      {
+        case 0: rgb[y * n + i] = row[i + 1]; break;
+        case 1: rgb[y * n + i] = row[i + 1] + a; break;
+        case 2: rgb[y * n + i] = row[i + 1] + b; break;
+        case 3: rgb[y * n + i] = row[i + 1] + ((a + b) >> 1); break;
+        case 4: rgb[y * n + i] = row[i + 1] + paeth(a, b, c); break;
+        default: ok = 0; break;
+      }
+    }
+  }
+
+  free(raw);
+  return ok;
+}
+
+/**
+ * Renders the scene in bands of the given height into a buffer
+ */
+static int
+render(buffer_t * b, puint32_t format, int level, puint32_t band)
+{
+  pig_output_t out;
+
+  memset(b, 0, sizeof(buffer_t));
+  pig_output_init(&out, NULL);
+  out.sink = buffer_sink;
+  out.user = b;
+  out.format = format;
+  out.level = level;
+  return pig_render_banded(&out, WIDTH, HEIGHT, band, draw_scene, NULL);
+}
+
+int main()
+{
+  buffer_t png, raw, whole;
+  puint8_t * rgb;
+  size_t i, diff;
+  int level, failed;
+
+  failed = 0;
+  if (!(rgb = (puint8_t*)malloc(WIDTH * HEIGHT * 3)) ||
+      !render(&raw, OUTPUT_RGB, 0, BAND) ||
+      !render(&whole, OUTPUT_RGB, 0, HEIGHT))
+  {
+    fprintf(stderr, "Cannot render the image\n");
+    return -1;
+  }
+
+  /* Stored blocks spread the stream over many IDAT chunks */
+  for (level = 0; level <= 9; level += 9)
+  {
+    if (!render(&png, OUTPUT_PNG, level, BAND) || !decode_png(&png, rgb))
+    {
+      fprintf(stderr, "Level %d: cannot decode the banded PNG\n", level);
+      failed = 1;
+    }
+    else if (memcmp(rgb, raw.data, raw.size))
+    {
+      fprintf(stderr, "Level %d: PNG and raw rows differ\n", level);
+      failed = 1;
+    }
+    free(png.data);
+  }
+
+  /* Bands move the vertices by whole pixels, only rounding may differ */
+  diff = 0;
+  for (i = 0; i < raw.size && raw.size == whole.size; ++i)
+  {
+    diff += raw.data[i] != whole.data[i];
+  }
+  if (raw.size != WIDTH * HEIGHT * 3 || raw.size != whole.size ||
+      diff > raw.size / 10000)
+  {
+    fprintf(stderr, "Bands differ from the whole image in %lu bytes\n",
+            (unsigned long)diff);
+    failed = 1;
+  }
+
+  free(raw.data);
+  free(whole.data);
+  free(rgb);
+  return failed ? -1 : 0;
+}
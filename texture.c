@@ -0,0 +1,191 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <string.h>
+#include "texture.h"
+
+/**
+ * Returns non-zero if n is a power of two
+ */
+static int
+is_pot(puint32_t n)
+{
+  return (n & (n - 1)) == 0;
+}
+
+/**
+ * Address of a texel in a level
+ */
+static puint8_t *
+texel_at(pig_texture_t * t, pig_level_t * l, puint32_t x, puint32_t y)
+{
+  return l->data + PIG_TEXEL_OFFSET(t, l, x, y);
+}
+
+/**
+ * Number of bytes taken up by a level
+ */
+static size_t
+level_size(pig_texture_t * t, pig_level_t * l)
+{
+  if (t->layout == TEX_TILED)
+  {
+    return (size_t)l->blocks * ((l->height + 3) >> 2) * 64;
+  }
+
+  return (size_t)l->width * l->height * 4;
+}
+
+/**
+ * Box-filters a level into the next, smaller one
+ * Odd sizes drop the last row or column, texels past the edge are clamped.
+ */
+static void
+downsample(pig_texture_t * t, pig_level_t * dst, pig_level_t * src)
+{
+  puint32_t x, y, x0, y0, x1, y1, i;
+  puint8_t * d, * s00, * s01, * s10, * s11;
+
+  for (y = 0; y < dst->height; ++y)
+  {
+    y0 = 2 * y;
+    y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+    for (x = 0; x < dst->width; ++x)
+    {
+      x0 = 2 * x;
+      x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+
+      d = texel_at(t, dst, x, y);
+      s00 = texel_at(t, src, x0, y0);
+      s01 = texel_at(t, src, x1, y0);
+      s10 = texel_at(t, src, x0, y1);
+      s11 = texel_at(t, src, x1, y1);
+      for (i = 0; i < 4; ++i)
+      {
+        d[i] = (s00[i] + s01[i] + s10[i] + s11[i] + 2) >> 2;
+      }
+    }
+  }
+}
+
+pig_texture_t *
+pig_texture_create(puint16_t width, puint16_t height, texlayout_t layout)
+{
+  pig_texture_t * t;
+  pig_level_t * l;
+  size_t size;
+  puint32_t i;
+
+  if (!width || !height)
+  {
+    return NULL;
+  }
+
+  if (!(t = (pig_texture_t*)malloc(sizeof(pig_texture_t))))
+  {
+    return NULL;
+  }
+
+  /* Lay out the chain down to a single texel */
+  t->width = width;
+  t->height = height;
+  t->layout = layout;
+  t->filter = TEX_NEAREST;
+  t->levels = 0;
+  size = 0;
+  while (1)
+  {
+    l = &t->level[t->levels++];
+    l->width = width;
+    l->height = height;
+    l->pot = is_pot(width) && is_pot(height);
+    l->blocks = (width + 3) >> 2;
+    size += level_size(t, l);
+    if (width == 1 && height == 1)
+    {
+      break;
+    }
+    width = width > 1 ? width >> 1 : 1;
+    height = height > 1 ? height >> 1 : 1;
+  }
+
+  /* Tiled levels are multiples of 64 bytes, so every block is aligned */
+  if (posix_memalign((void**)&t->data, 64, size))
+  {
+    free(t);
+    return NULL;
+  }
+  memset(t->data, 0, size);
+
+  size = 0;
+  for (i = 0; i < t->levels; ++i)
+  {
+    t->level[i].data = t->data + size;
+    size += level_size(t, &t->level[i]);
+  }
+
+  return t;
+}
+
+void
+pig_texture_upload(pig_texture_t * t, puint8_t * data)
+{
+  puint32_t i, x, y, n;
+
+  if (t->layout == TEX_TILED)
+  {
+    /* Rows of a block are 16 bytes, swizzle them in one copy each */
+    for (y = 0; y < t->height; ++y)
+    {
+      for (x = 0; x < t->width; x += 4)
+      {
+        n = t->width - x < 4 ? t->width - x : 4;
+        memcpy(texel_at(t, &t->level[0], x, y),
+               data + ((y * t->width + x) << 2), n * 4);
+      }
+    }
+  }
+  else
+  {
+    memcpy(t->level[0].data, data, (size_t)t->width * t->height * 4);
+  }
+
+  for (i = 1; i < t->levels; ++i)
+  {
+    downsample(t, &t->level[i], &t->level[i - 1]);
+  }
+}
+
+void
+pig_texture_free(pig_texture_t * t)
+{
+  if (!t)
+  {
+    return;
+  }
+
+  free(t->data);
+  free(t);
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2014 Nandor Licker
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+#ifndef __PIG_TEXTURE_H__
+#define __PIG_TEXTURE_H__
+
+#include "types.h"
+
+/* Maximum number of mipmap levels, enough for 65535 texels */
+#define PIG_MAX_LEVELS 16
+
+/* Texel storage layouts */
+typedef enum
+{
+  /* Texels row by row */
+  TEX_LINEAR = 0,
+  /* 4x4 texel blocks filling a 64-byte cache line each, blocks row by row */
+  TEX_TILED = 1
+} texlayout_t;
+
+/* Texture filters */
+typedef enum
+{
+  /* Nearest texel of the selected level */
+  TEX_NEAREST = 0,
+  /* Weighted average of the four nearest texels of the selected level */
+  TEX_BILINEAR = 1
+} texfilter_t;
+
+/* Single level of a mipmap chain */
+typedef struct
+{
+  /* Size of the level in texels */
+  puint16_t width;
+  puint16_t height;
+  /* Non-zero if both sides are powers of two, wrapping is done by masking */
+  puint32_t pot;
+  /* Number of 4x4 blocks in a row of a tiled level */
+  puint32_t blocks;
+  /* RGBA8 texels */
+  puint8_t * data;
+} pig_level_t;
+
+/* Mipmapped RGBA8 texture */
+typedef struct
+{
+  /* Size of the base level */
+  puint16_t width;
+  puint16_t height;
+  /* Storage layout of all levels */
+  puint32_t layout;
+  /* Sampling filter */
+  puint32_t filter;
+  /* Number of levels, each level is half the size of the previous one */
+  puint32_t levels;
+  pig_level_t level[PIG_MAX_LEVELS];
+  /* Storage of all the levels */
+  puint8_t * data;
+} pig_texture_t;
+
+/* Byte offset of texel (x, y) in level l of texture t, shared by upload and
+ * sampling. Tiled levels store each 4x4 block as four 16-byte rows. */
+#define PIG_TEXEL_OFFSET(t, l, x, y)                                          \
+  ((t)->layout == TEX_TILED ?                                                 \
+   ((((size_t)((y) >> 2) * (l)->blocks + ((x) >> 2)) << 6) |                  \
+    (((y) & 3) << 4) | (((x) & 3) << 2)) :                                    \
+   (((size_t)(y) * (l)->width + (x)) << 2))
+
+pig_texture_t * pig_texture_create(puint16_t, puint16_t, texlayout_t);
+void pig_texture_upload(pig_texture_t *, puint8_t *);
+void pig_texture_free(pig_texture_t *);
+
+#endif /*__PIG_TEXTURE_H__*/
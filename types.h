@@ -32,4 +32,7 @@ typedef signed char pint8_t;
 typedef signed short pint16_t;
 typedef signed int pint32_t;
 
+__extension__ typedef unsigned long long puint64_t;
+__extension__ typedef signed long long pint64_t;
+
 #endif
@@ -151,6 +151,42 @@ vec_mul(vec * d, vec * a, mat b)
   _mm_storeu_ps((float*)d, acc);
 }
 
+/**
+ * Transforms n vectors stored in structure-of-arrays form
+ * Vectors are packed in blocks of four: x[4], y[4], z[4], w[4]. The blocks
+ * must be 16-byte aligned and n is rounded up to a multiple of four. Each
+ * component is accumulated in the same order as in vec_mul, so the results
+ * are identical.
+ */
+void
+vec_mul_batch(float * d, float * a, mat b, unsigned n)
+{
+  __m128 x, y, z, w, m0, m1, m2, m3;
+  unsigned i, j;
+
+  for (i = 0; i < n; i += 4, a += 16, d += 16)
+  {
+    x = _mm_load_ps(a + 0);
+    y = _mm_load_ps(a + 4);
+    z = _mm_load_ps(a + 8);
+    w = _mm_load_ps(a + 12);
+
+    for (j = 0; j < 4; ++j)
+    {
+      m0 = _mm_set1_ps(b[j + 0]);
+      m1 = _mm_set1_ps(b[j + 4]);
+      m2 = _mm_set1_ps(b[j + 8]);
+      m3 = _mm_set1_ps(b[j + 12]);
+      _mm_store_ps(d + j * 4, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(x, m0),
+        _mm_mul_ps(y, m1)),
+        _mm_mul_ps(z, m2)),
+        _mm_mul_ps(w, m3)
+      ));
+    }
+  }
+}
+
 void
 vec_cross(vec * d, vec * a, vec * b)
 {
@@ -226,3 +262,56 @@ vec_norm(vec * a)
     _mm_storeu_ps((float*)a, _mm_mul_ps(al, tmp));
   }
 }
+
+/**
+ * Normalizes n vectors whose components are stored in separate arrays
+ * The arrays must be 16-byte aligned and n is rounded up to a multiple of
+ * four. Zero vectors are left unchanged.
+ */
+void
+vec_norm_batch(float * x, float * y, float * z, unsigned n)
+{
+  __m128 xl, yl, zl, len, keep;
+  unsigned i;
+
+  for (i = 0; i < n; i += 4)
+  {
+    xl = _mm_load_ps(x + i);
+    yl = _mm_load_ps(y + i);
+    zl = _mm_load_ps(z + i);
+
+    len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xl, xl), _mm_mul_ps(yl, yl)),
+                     _mm_mul_ps(zl, zl));
+    keep = _mm_cmpeq_ps(len, _mm_setzero_ps());
+    len = _mm_or_ps(_mm_andnot_ps(keep, _mm_rsqrt_ps(len)),
+                    _mm_and_ps(keep, _mm_set1_ps(1.0f)));
+
+    _mm_store_ps(x + i, _mm_mul_ps(xl, len));
+    _mm_store_ps(y + i, _mm_mul_ps(yl, len));
+    _mm_store_ps(z + i, _mm_mul_ps(zl, len));
+  }
+}
+
+/**
+ * Dot products of n vectors stored in separate arrays with a single vector
+ * Alignment and rounding are the same as in vec_norm_batch.
+ */
+void
+vec_dot_batch(float * d, float * x, float * y, float * z, vec * b,
+              unsigned n)
+{
+  __m128 bx, by, bz;
+  unsigned i;
+
+  bx = _mm_set1_ps(b->x);
+  by = _mm_set1_ps(b->y);
+  bz = _mm_set1_ps(b->z);
+  for (i = 0; i < n; i += 4)
+  {
+    _mm_store_ps(d + i, _mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(_mm_load_ps(x + i), bx),
+      _mm_mul_ps(_mm_load_ps(y + i), by)),
+      _mm_mul_ps(_mm_load_ps(z + i), bz)
+    ));
+  }
+}
@@ -43,9 +43,13 @@ void mat_mul(mat dest, mat a, mat b);
 void mat_dump(mat m);
 
 void vec_mul(vec * dest, vec * a, mat b);
+void vec_mul_batch(float * dest, float * a, mat b, unsigned n);
 void vec_cross(vec * dest, vec * a, vec * b);
 float vec_dot(vec * a, vec * b);
 float vec_len(vec * a);
 void vec_norm(vec * a);
+void vec_norm_batch(float * x, float * y, float * z, unsigned n);
+void vec_dot_batch(float * d, float * x, float * y, float * z, vec * b,
+                   unsigned n);
 
 #endif /*__PIG_VECMATH_H__*/